@@ -0,0 +1,59 @@
+#include "atomic_file.h"
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+AtomicFile::AtomicFile(const std::string & path) : mPath(path), mFd(-1)
+{
+	size_t slash = path.rfind('/');
+	size_t nameStart = (slash == path.npos ? 0 : slash + 1);
+
+	mTemporary = path.substr(0, nameStart) + ".tmp." + path.substr(nameStart) + ".XXXXXX";
+	mFd = mkostemp(&mTemporary[0], O_CLOEXEC);
+	if (mFd < 0)
+		mTemporary.clear();
+}
+
+AtomicFile::~AtomicFile()
+{
+	if (mFd >= 0)
+		close(mFd);
+	if (!mTemporary.empty())
+		unlink(mTemporary.c_str());
+}
+
+bool AtomicFile::write(const void * data, size_t size)
+{
+	const char * bytes = static_cast<const char *>(data);
+	while (mFd >= 0 && size > 0)
+	{
+		ssize_t written = ::write(mFd, bytes, size);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+
+		bytes += written;
+		size -= written;
+	}
+
+	return mFd >= 0;
+}
+
+bool AtomicFile::commit(mode_t mode)
+{
+	if (mFd < 0)
+		return false;
+
+	bool success = fchmod(mFd, mode) == 0 && fdatasync(mFd) == 0;
+	success = (close(mFd) == 0) && success;
+	mFd = -1;
+
+	if (!success || rename(mTemporary.c_str(), mPath.c_str()) != 0)
+		return false;
+
+	mTemporary.clear();
+	return true;
+}
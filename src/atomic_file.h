@@ -0,0 +1,32 @@
+#ifndef ATOMIC_FILE_H_
+#define ATOMIC_FILE_H_
+
+#include <string>
+#include <sys/types.h>
+
+/*
+ * File written under a temporary name next to its path and renamed over it
+ * once complete and synced, so neither a reader nor a crash ever sees a
+ * partial one. The temporary name starts with ".tmp.", a file that was never
+ * committed is removed when the AtomicFile goes away.
+ */
+class AtomicFile
+{
+public:
+	AtomicFile(const std::string & path);
+	AtomicFile(const AtomicFile & other) = delete;
+	~AtomicFile();
+
+	inline bool valid() const { return mFd >= 0; }
+
+	bool write(const void * data, size_t size);
+	// Syncs the file, gives it mode and renames it over path
+	bool commit(mode_t mode);
+
+private:
+	std::string mPath;
+	std::string mTemporary;
+	int mFd;
+};
+
+#endif // ATOMIC_FILE_H_
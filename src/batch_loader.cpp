@@ -0,0 +1,81 @@
+#include "batch_loader.h"
+#include <algorithm>
+#include <fcntl.h>
+
+namespace
+{
+
+// Objects closer than this share one readahead range
+constexpr uint64_t ReadaheadGap = 256 << 10;
+// Allowance for the data of the last object of a range, its end is unknown
+constexpr uint64_t ReadaheadTail = 64 << 10;
+// Upper bound for the readahead of a single batch
+constexpr uint64_t MaxReadahead = 64 << 20;
+
+} // namespace
+
+BatchLoader::BatchLoader(const GitRepositoryView & repo) : mRepository(repo)
+{
+}
+
+BatchLoader::~BatchLoader()
+{
+}
+
+void BatchLoader::add(const git_oid & oid)
+{
+	Item item = { nullptr, 0, mItems.size(), oid };
+
+	PackIndex::Location location;
+	if (PackIndex::forRepository(mRepository).find(oid, location))
+	{
+		item.pack = location.pack.get();
+		item.offset = location.offset;
+
+		// Keep every pack of the batch open until it has been run
+		if (std::find(mPacks.begin(), mPacks.end(), location.pack) == mPacks.end())
+			mPacks.push_back(std::move(location.pack));
+	}
+
+	mItems.push_back(item);
+}
+
+void BatchLoader::run(const Visitor & visit)
+{
+	// Packed objects by pack and offset, loose ones after them as they came
+	std::stable_sort(mItems.begin(), mItems.end(), [] (const Item & lhs, const Item & rhs)
+	{
+		if (!lhs.pack || !rhs.pack)
+			return lhs.pack && !rhs.pack;
+		if (lhs.pack != rhs.pack)
+			return std::less<const PackIndex::PackFile *>()(lhs.pack, rhs.pack);
+		return lhs.offset < rhs.offset;
+	});
+
+	readahead();
+
+	for (const Item & item : mItems)
+	{
+		if (!visit(item.index, item.oid))
+			break;
+	}
+}
+
+void BatchLoader::readahead() const
+{
+	uint64_t budget = MaxReadahead;
+
+	for (size_t i = 0; i < mItems.size() && mItems[i].pack && budget > 0; )
+	{
+		const PackIndex::PackFile * pack = mItems[i].pack;
+		uint64_t start = mItems[i].offset;
+		uint64_t end = start + ReadaheadTail;
+
+		for (++i; i < mItems.size() && mItems[i].pack == pack && mItems[i].offset <= end + ReadaheadGap; ++i)
+			end = mItems[i].offset + ReadaheadTail;
+
+		uint64_t length = std::min(end - start, budget);
+		budget -= length;
+		posix_fadvise(pack->fd(), off_t(start), off_t(length), POSIX_FADV_WILLNEED);
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef BATCH_LOADER_H_
+#define BATCH_LOADER_H_
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "git_wrappers.h"
+#include "pack_index.h"
+
+/*
+ * Visits a set of objects in the order they are stored in the packs rather
+ * than the order they were asked for. The pack ranges the batch covers are
+ * handed to the kernel for readahead before the first object is read, so a
+ * cold walk reads each pack front to back instead of seeking around it, and
+ * delta bases, which precede their deltas, are still in libgit2's base
+ * cache when the objects built on them are read. Objects that are not
+ * packed are visited last, in the order they were added.
+ */
+class BatchLoader
+{
+public:
+	// index is the position the object was added at, returning false stops the batch
+	using Visitor = std::function<bool(size_t index, const git_oid & oid)>;
+
+public:
+	BatchLoader(const GitRepositoryView & repo);
+	BatchLoader(const BatchLoader & other) = delete;
+	~BatchLoader();
+
+	void add(const git_oid & oid);
+
+	inline size_t size() const { return mItems.size(); }
+
+	// Calls visit on this thread for every object
+	void run(const Visitor & visit);
+
+private:
+	struct Item
+	{
+		const PackIndex::PackFile * pack;
+		uint64_t offset;
+		size_t index;
+		git_oid oid;
+	};
+
+	void readahead() const;
+
+	GitRepositoryView mRepository;
+	std::vector<Item> mItems;
+	std::vector<PackIndex::PackFilePtr> mPacks;
+};
+
+#endif // BATCH_LOADER_H_
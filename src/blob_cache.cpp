@@ -0,0 +1,180 @@
+#include "blob_cache.h"
+#include "object_store.h"
+#include "repository_pool.h"
+
+namespace
+{
+
+constexpr size_t DefaultBudget = 256 << 20;
+
+}
+
+BlobCache::Pin::Pin(BlobCache * cache, std::shared_ptr<Entry> entry) : mCache(cache), mEntry(std::move(entry))
+{
+}
+
+BlobCache::Pin::Pin(Pin && other) : mCache(other.mCache), mEntry(std::move(other.mEntry))
+{
+	other.mCache = nullptr;
+}
+
+BlobCache::Pin::~Pin()
+{
+	release();
+}
+
+BlobCache::Pin& BlobCache::Pin::operator= (Pin && other)
+{
+	if (this != &other)
+	{
+		release();
+		mCache = other.mCache;
+		mEntry = std::move(other.mEntry);
+		other.mCache = nullptr;
+	}
+	return *this;
+}
+
+const void * BlobCache::Pin::data() const
+{
+	if (!mEntry)
+		return nullptr;
+	return (mEntry->mapped ? mEntry->mapped.get() : mEntry->blob.content());
+}
+
+size_t BlobCache::Pin::size() const
+{
+	return (mEntry ? mEntry->size : 0);
+}
+
+void BlobCache::Pin::release()
+{
+	if (mCache && mEntry)
+		mCache->unpin(*mEntry);
+
+	mCache = nullptr;
+	mEntry.reset();
+}
+
+BlobCache & BlobCache::instance()
+{
+	static BlobCache cache;
+	return cache;
+}
+
+BlobCache::BlobCache() : mBytes(0), mBudget(DefaultBudget), mHits(0), mMisses(0), mEvictions(0)
+{
+}
+
+BlobCache::~BlobCache()
+{
+}
+
+void BlobCache::setBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(mLock);
+	mBudget = bytes;
+	evict();
+}
+
+BlobCache::Pin BlobCache::get(const GitRepositoryView & repo, const git_oid * oid)
+{
+	if (!oid)
+		return Pin();
+
+	std::unique_lock<std::mutex> guard(mLock);
+
+	auto iter = mEntries.find(*oid);
+	if (iter != mEntries.end())
+	{
+		Entry & entry = *iter->second;
+		++entry.pins;
+		mLru.splice(mLru.end(), mLru, entry.lru);
+		++mHits;
+		return Pin(this, iter->second);
+	}
+
+	++mMisses;
+	guard.unlock();
+
+	// Inflate without holding the lock, another thread may race us to it
+	auto entry = std::make_shared<Entry>();
+	entry->oid = *oid;
+	entry->pins = 1;
+	entry->mapped = ObjectStore::instance().map(*oid, entry->size);
+	if (!entry->mapped)
+	{
+		entry->blob = RepositoryPool::local(repo).resolveBlob(oid);
+		if (!entry->blob)
+			return Pin();
+		entry->size = entry->blob.size();
+	}
+
+	guard.lock();
+
+	auto inserted = mEntries.emplace(*oid, entry);
+	if (!inserted.second)
+	{
+		Entry & existing = *inserted.first->second;
+		++existing.pins;
+		mLru.splice(mLru.end(), mLru, existing.lru);
+		return Pin(this, inserted.first->second);
+	}
+
+	entry->lru = mLru.insert(mLru.end(), entry.get());
+	mBytes += entry->size;
+	evict();
+
+	return Pin(this, std::move(entry));
+}
+
+void BlobCache::unpin(Entry & entry)
+{
+	std::lock_guard<std::mutex> guard(mLock);
+
+	if (entry.pins > 0)
+		--entry.pins;
+
+	if (entry.pins == 0 && mBytes > mBudget)
+		evict();
+}
+
+void BlobCache::evict()
+{
+	// Caller holds mLock
+	auto iter = mLru.begin();
+	while (mBytes > mBudget && iter != mLru.end())
+	{
+		Entry * entry = *iter;
+		if (entry->pins > 0)
+		{
+			++iter;
+			continue;
+		}
+
+		iter = mLru.erase(iter);
+		mBytes -= entry->size;
+		++mEvictions;
+
+		// Drops the reference held by the cache
+		mEntries.erase(entry->oid);
+	}
+}
+
+BlobCache::Stats BlobCache::stats() const
+{
+	std::lock_guard<std::mutex> guard(mLock);
+
+	Stats stats;
+	stats.hits = mHits;
+	stats.misses = mMisses;
+	stats.evictions = mEvictions;
+	stats.entries = mEntries.size();
+	stats.pinned = 0;
+	for (const Entry * entry : mLru)
+		if (entry->pins > 0)
+			++stats.pinned;
+	stats.bytes = mBytes;
+	stats.budget = mBudget;
+	return stats;
+}
@@ -0,0 +1,99 @@
+#ifndef BLOB_CACHE_H_
+#define BLOB_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <sys/types.h>
+#include "git_wrappers.h"
+
+/*
+ * Process wide cache of inflated blob contents keyed by oid. Every FSBlob
+ * for the same oid shares a single copy, no matter which commit or branch it
+ * was reached through. Entries are pinned for as long as a Pin exists for
+ * them; unpinned entries are evicted in LRU order once the byte budget is
+ * exceeded. Content the object store has on disk is mapped from there
+ * rather than inflated from the pack.
+ */
+class BlobCache
+{
+private:
+	struct Entry;
+
+public:
+	// Blobs worth inflating ahead of use, larger ones are streamed or stored anyway
+	static constexpr off_t SmallBlob = 1 << 20;
+
+	class Pin
+	{
+	public:
+		inline Pin() : mCache(nullptr) {}
+		Pin(const Pin & other) = delete;
+		Pin(Pin && other);
+		~Pin();
+
+		Pin& operator= (const Pin & other) = delete;
+		Pin& operator= (Pin && other);
+
+		const void * data() const;
+		size_t size() const;
+		inline explicit operator bool() const { return bool(mEntry); }
+
+		void release();
+
+	private:
+		friend class BlobCache;
+		Pin(BlobCache * cache, std::shared_ptr<Entry> entry);
+
+		BlobCache * mCache;
+		std::shared_ptr<Entry> mEntry;
+	};
+
+	struct Stats
+	{
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		size_t entries;
+		size_t pinned;
+		size_t bytes;
+		size_t budget;
+	};
+
+public:
+	static BlobCache & instance();
+
+	void setBudget(size_t bytes);
+	Pin get(const GitRepositoryView & repo, const git_oid * oid);
+	Stats stats() const;
+
+private:
+	BlobCache();
+	~BlobCache();
+
+	void unpin(Entry & entry);
+	void evict();
+
+	struct Entry
+	{
+		git_oid oid;
+		GitBlob blob;
+		std::shared_ptr<const char> mapped;
+		size_t size;
+		unsigned int pins;
+		std::list<Entry*>::iterator lru;
+	};
+
+	mutable std::mutex mLock;
+	std::unordered_map<git_oid, std::shared_ptr<Entry>, GitOidHash> mEntries;
+	std::list<Entry*> mLru;
+	size_t mBytes;
+	size_t mBudget;
+	uint64_t mHits;
+	uint64_t mMisses;
+	uint64_t mEvictions;
+};
+
+#endif // BLOB_CACHE_H_
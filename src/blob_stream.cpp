@@ -0,0 +1,258 @@
+#include "blob_stream.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <string_view>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr size_t WindowSize = 32768;
+constexpr size_t InputSize = 16384;
+constexpr size_t ZlibHeaderSize = 2;
+
+// Keeps the checkpoint windows of a single object at or below 8MB
+constexpr uint64_t MinimumSpan = 1 << 20;
+constexpr uint64_t MaximumCheckpoints = 256;
+
+} // namespace
+
+ShardedMap<git_oid, std::weak_ptr<BlobStream::Index>, GitOidHash> BlobStream::gIndexes(1 << 12);
+
+std::unique_ptr<BlobStream> BlobStream::open(const GitRepositoryView & repo, const git_oid * oid)
+{
+	if (!oid)
+		return nullptr;
+
+	PackIndex::Stream raw;
+	if (!PackIndex::forRepository(repo).openStream(*oid, GIT_OBJECT_BLOB, raw))
+		return nullptr;
+
+	std::unique_ptr<BlobStream> stream(new BlobStream(std::move(raw)));
+
+	std::weak_ptr<Index> existing;
+	if (gIndexes.find(*oid, existing))
+		stream->mIndex = existing.lock();
+
+	if (!stream->mIndex)
+	{
+		auto index = std::make_shared<Index>();
+		auto start = std::make_shared<Checkpoint>();
+		start->in = stream->mStream.start + ZlibHeaderSize;
+		start->out = 0;
+		start->bits = 0;
+		index->checkpoints.push_back(start);
+		index->contentStart = 0;
+		index->size = stream->mStream.size;
+
+		if (!stream->restart(*start))
+			return nullptr;
+
+		if (stream->mStream.loose && !stream->readLooseHeader(index->contentStart, index->size))
+			return nullptr;
+
+		index->span = std::max(MinimumSpan, index->size / MaximumCheckpoints);
+		stream->mIndex = index;
+		gIndexes.insert(*oid, index);
+	}
+
+	return stream;
+}
+
+BlobStream::BlobStream(PackIndex::Stream && stream) : mStream(std::move(stream)), mZ{}, mZInit(false), mEnded(false), mInPos(0), mOut(0), mWinPos(0), mWinFill(0)
+{
+	mIn.reset(new unsigned char[InputSize]);
+	mWindow.reset(new unsigned char[WindowSize]);
+}
+
+BlobStream::~BlobStream()
+{
+	if (mZInit)
+		inflateEnd(&mZ);
+
+	if (mStream.loose && mStream.fd >= 0)
+		close(mStream.fd);
+}
+
+uint64_t BlobStream::size() const
+{
+	return mIndex->size;
+}
+
+bool BlobStream::readLooseHeader(uint64_t & contentStart, uint64_t & size)
+{
+	// Loose objects start with "blob <size>\0", it is never longer than this
+	char header[32];
+	size_t have = 0;
+
+	while (have < sizeof(header))
+	{
+		ssize_t produced = inflateStep(header + have, sizeof(header) - have);
+		if (produced < 0)
+			return false;
+		have += produced;
+
+		if (std::memchr(header, 0, have) || mEnded)
+			break;
+	}
+
+	std::string_view text(header, have);
+	size_t nul = text.find('\0');
+	if (nul == text.npos || text.substr(0, 5) != "blob ")
+		return false;
+
+	auto [ptr, ec] = std::from_chars(header + 5, header + nul, size);
+	if (ec != std::errc() || ptr != header + nul)
+		return false;
+
+	contentStart = nul + 1;
+	return true;
+}
+
+bool BlobStream::restart(const Checkpoint & checkpoint)
+{
+	int zerr = (mZInit ? inflateReset(&mZ) : inflateInit2(&mZ, -15));
+	if (zerr != Z_OK)
+		return false;
+	mZInit = true;
+
+	mZ.avail_in = 0;
+	mZ.next_in = mIn.get();
+	mInPos = checkpoint.in - (checkpoint.bits ? 1 : 0);
+
+	if (checkpoint.bits)
+	{
+		unsigned char byte;
+		if (pread(mStream.fd, &byte, 1, mInPos) != 1)
+			return false;
+		++mInPos;
+		inflatePrime(&mZ, checkpoint.bits, byte >> (8 - checkpoint.bits));
+	}
+
+	size_t windowSize = checkpoint.window.size();
+	if (windowSize > 0)
+	{
+		inflateSetDictionary(&mZ, checkpoint.window.data(), windowSize);
+		std::memcpy(mWindow.get(), checkpoint.window.data(), windowSize);
+	}
+
+	mWinPos = windowSize;
+	mWinFill = windowSize;
+	mOut = checkpoint.out;
+	mEnded = false;
+	return true;
+}
+
+ssize_t BlobStream::inflateStep(char * dest, size_t want)
+{
+	if (mEnded)
+		return 0;
+
+	if (mZ.avail_in == 0)
+	{
+		ssize_t got = pread(mStream.fd, mIn.get(), InputSize, mInPos);
+		if (got <= 0)
+			return -1;
+
+		mInPos += got;
+		mZ.next_in = mIn.get();
+		mZ.avail_in = got;
+	}
+
+	if (mWinPos == WindowSize)
+		mWinPos = 0;
+
+	size_t room = std::min(WindowSize - mWinPos, want);
+	mZ.next_out = mWindow.get() + mWinPos;
+	mZ.avail_out = room;
+
+	int zerr = inflate(&mZ, Z_BLOCK);
+	if (zerr == Z_NEED_DICT || zerr == Z_DATA_ERROR || zerr == Z_MEM_ERROR || zerr == Z_STREAM_ERROR)
+		return -1;
+
+	size_t produced = room - mZ.avail_out;
+	if (dest && produced)
+		std::memcpy(dest, mWindow.get() + mWinPos, produced);
+
+	mWinPos += produced;
+	mWinFill = std::min(WindowSize, mWinFill + produced);
+	mOut += produced;
+
+	if (zerr == Z_STREAM_END)
+		mEnded = true;
+	else if ((mZ.data_type & 128) && !(mZ.data_type & 64))
+		addCheckpoint();
+
+	return produced;
+}
+
+void BlobStream::addCheckpoint()
+{
+	std::lock_guard<std::mutex> guard(mIndex->lock);
+
+	const Checkpoint & last = *mIndex->checkpoints.back();
+	if (mOut < last.out + mIndex->span)
+		return;
+
+	auto checkpoint = std::make_shared<Checkpoint>();
+	checkpoint->in = mInPos - mZ.avail_in;
+	checkpoint->out = mOut;
+	checkpoint->bits = mZ.data_type & 7;
+
+	// The window is circular once it has been filled completely
+	checkpoint->window.reserve(mWinFill);
+	if (mWinFill == WindowSize)
+		checkpoint->window.insert(checkpoint->window.end(), mWindow.get() + mWinPos, mWindow.get() + WindowSize);
+	checkpoint->window.insert(checkpoint->window.end(), mWindow.get(), mWindow.get() + mWinPos);
+
+	mIndex->checkpoints.push_back(std::move(checkpoint));
+}
+
+BlobStream::CheckpointPtr BlobStream::nearestCheckpoint(uint64_t out) const
+{
+	std::lock_guard<std::mutex> guard(mIndex->lock);
+
+	auto iter = std::upper_bound(mIndex->checkpoints.begin(), mIndex->checkpoints.end(), out, [] (uint64_t value, const CheckpointPtr & checkpoint) { return value < checkpoint->out; });
+	return *std::prev(iter);
+}
+
+int BlobStream::read(char * buffer, size_t bufsize, off_t offset)
+{
+	if (offset < 0)
+		return -EINVAL;
+
+	uint64_t target = mIndex->contentStart + offset;
+	uint64_t end = mIndex->contentStart + mIndex->size;
+	if (target >= end)
+		return 0;
+
+	// Continue where the previous read stopped if that is cheaper than seeking
+	if (target < mOut || target - mOut > mIndex->span)
+	{
+		CheckpointPtr checkpoint = nearestCheckpoint(target);
+		if ((target < mOut || checkpoint->out > mOut) && !restart(*checkpoint))
+			return -EIO;
+	}
+
+	while (mOut < target)
+	{
+		ssize_t skipped = inflateStep(nullptr, std::min<uint64_t>(target - mOut, WindowSize));
+		if (skipped < 0 || (skipped == 0 && mEnded))
+			return -EIO;
+	}
+
+	size_t wanted = std::min<uint64_t>(bufsize, end - target);
+	size_t copied = 0;
+	while (copied < wanted)
+	{
+		ssize_t produced = inflateStep(buffer + copied, wanted - copied);
+		if (produced < 0)
+			return -EIO;
+		if (produced == 0 && mEnded)
+			break;
+		copied += produced;
+	}
+
+	return copied;
+}
@@ -0,0 +1,80 @@
+#ifndef BLOB_STREAM_H_
+#define BLOB_STREAM_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/types.h>
+#include <zlib.h>
+#include "pack_index.h"
+#include "sharded_map.h"
+
+/*
+ * Random access reader for large blobs that inflates straight from the zlib
+ * data of a loose object or an undeltified packed object. The first walk
+ * through an object records inflate checkpoints at deflate block boundaries,
+ * in the spirit of zlib's zran example, so later reads at any offset resume
+ * from the nearest checkpoint instead of inflating from the start. The
+ * checkpoints are shared by every open stream of the same oid, and each open
+ * stream only ever holds a single window and input buffer.
+ */
+class BlobStream
+{
+public:
+	// Fails if the object is deltified or otherwise can't be streamed
+	static std::unique_ptr<BlobStream> open(const GitRepositoryView & repo, const git_oid * oid);
+
+	BlobStream(const BlobStream & other) = delete;
+	~BlobStream();
+
+	int read(char * buffer, size_t bufsize, off_t offset);
+	uint64_t size() const;
+
+private:
+	struct Checkpoint
+	{
+		uint64_t in;
+		uint64_t out;
+		int bits;
+		std::vector<unsigned char> window;
+	};
+
+	using CheckpointPtr = std::shared_ptr<const Checkpoint>;
+
+	struct Index
+	{
+		std::mutex lock;
+		std::vector<CheckpointPtr> checkpoints;
+		uint64_t span;
+		uint64_t contentStart;
+		uint64_t size;
+	};
+
+	// Indexes live as long as a stream on the object is open
+	static ShardedMap<git_oid, std::weak_ptr<Index>, GitOidHash> gIndexes;
+
+	BlobStream(PackIndex::Stream && stream);
+
+	bool restart(const Checkpoint & checkpoint);
+	ssize_t inflateStep(char * dest, size_t want);
+	void addCheckpoint();
+	CheckpointPtr nearestCheckpoint(uint64_t out) const;
+	bool readLooseHeader(uint64_t & contentStart, uint64_t & size);
+
+	PackIndex::Stream mStream;
+	std::shared_ptr<Index> mIndex;
+
+	z_stream mZ;
+	bool mZInit;
+	bool mEnded;
+	uint64_t mInPos;
+	uint64_t mOut;
+
+	std::unique_ptr<unsigned char[]> mIn;
+	std::unique_ptr<unsigned char[]> mWindow;
+	size_t mWinPos;
+	size_t mWinFill;
+};
+
+#endif // BLOB_STREAM_H_
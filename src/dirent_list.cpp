@@ -0,0 +1,46 @@
+#include "dirent_list.h"
+#include <fuse_lowlevel.h>
+
+DirentList::DirentList()
+{
+}
+
+DirentList::~DirentList()
+{
+}
+
+void DirentList::reserve(size_t count, size_t nameBytes)
+{
+	mEntries.reserve(count);
+	mNames.reserve(nameBytes);
+}
+
+void DirentList::add(std::string_view name, const struct stat & st)
+{
+	// Names are nul terminated within the buffer
+	mEntries.push_back(Entry { mNames.size(), st });
+	mNames.append(name);
+	mNames.push_back('\0');
+}
+
+const DirentList::Packed & DirentList::packed() const
+{
+	std::call_once(mPackedOnce, [this] ()
+	{
+		mPacked.ends.reserve(mEntries.size());
+
+		for (size_t i = 0; i < mEntries.size(); ++i)
+		{
+			// Plain dirents don't depend on the request, libfuse ignores it
+			const char * entryName = name(i);
+			size_t start = mPacked.data.size();
+			size_t length = fuse_add_direntry(nullptr, nullptr, 0, entryName, &mEntries[i].st, 0);
+
+			mPacked.data.resize(start + length);
+			fuse_add_direntry(nullptr, &mPacked.data[start], length, entryName, &mEntries[i].st, off_t(i) + FirstOffset);
+			mPacked.ends.push_back(start + length);
+		}
+	});
+
+	return mPacked;
+}
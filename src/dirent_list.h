@@ -0,0 +1,57 @@
+#ifndef DIRENT_LIST_H_
+#define DIRENT_LIST_H_
+
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/stat.h>
+
+/*
+ * Flattened listing of a directory, names plus the attributes readdir hands
+ * to the kernel. Lists of trees are immutable and shared per tree oid, so a
+ * listing is built once and every later readdir resumes at its offset by
+ * index instead of rescanning the directory.
+ */
+class DirentList
+{
+public:
+	// Readdir resumes at 1 and 2 after "." and "..", and at i + FirstOffset after entry i
+	static constexpr off_t FirstOffset = 3;
+
+	// Entries serialized as FUSE dirents, ends[i] is the end of entry i in data
+	struct Packed
+	{
+		std::string data;
+		std::vector<size_t> ends;
+	};
+
+public:
+	DirentList();
+	~DirentList();
+
+	void reserve(size_t count, size_t nameBytes);
+	void add(std::string_view name, const struct stat & st);
+
+	inline size_t size() const { return mEntries.size(); }
+	inline const char * name(size_t index) const { return mNames.data() + mEntries[index].nameOffset; }
+	inline const struct stat & stat(size_t index) const { return mEntries[index].st; }
+
+	// Serialized on first use, the list must not change after that
+	const Packed & packed() const;
+
+private:
+	struct Entry
+	{
+		size_t nameOffset;
+		struct stat st;
+	};
+
+	std::string mNames;
+	std::vector<Entry> mEntries;
+
+	mutable std::once_flag mPackedOnce;
+	mutable Packed mPacked;
+};
+
+#endif // DIRENT_LIST_H_
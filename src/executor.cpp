@@ -0,0 +1,47 @@
+#include "executor.h"
+
+Executor::Executor(size_t threads) : mStopping(false)
+{
+	mThreads.reserve(threads);
+	for (size_t i = 0; i < threads; ++i)
+		mThreads.emplace_back(&Executor::run, this);
+}
+
+Executor::~Executor()
+{
+	{
+		std::lock_guard<std::mutex> guard(mLock);
+		mStopping = true;
+	}
+	mWake.notify_all();
+
+	for (auto & thread : mThreads)
+		thread.join();
+}
+
+void Executor::submit(Task task)
+{
+	{
+		std::lock_guard<std::mutex> guard(mLock);
+		mQueue.push_back(std::move(task));
+	}
+	mWake.notify_one();
+}
+
+void Executor::run()
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	while (true)
+	{
+		mWake.wait(lock, [this] { return mStopping || !mQueue.empty(); });
+		if (mQueue.empty())
+			break;
+
+		Task task = std::move(mQueue.front());
+		mQueue.pop_front();
+
+		lock.unlock();
+		task();
+		lock.lock();
+	}
+}
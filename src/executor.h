@@ -0,0 +1,42 @@
+#ifndef EXECUTOR_H_
+#define EXECUTOR_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Threads for requests that may have to inflate or decode objects. The
+ * FUSE workers hand such requests over and go back to the kernel at once,
+ * so a few slow inflates can't hold up cheap metadata requests behind them.
+ * Tasks reply to their requests themselves. Tasks still queued when the
+ * executor is destroyed are run before the threads are joined.
+ */
+class Executor
+{
+public:
+	using Task = std::function<void()>;
+
+public:
+	Executor(size_t threads);
+	Executor(const Executor & other) = delete;
+	~Executor();
+
+	void submit(Task task);
+
+	inline size_t threadCount() const { return mThreads.size(); }
+
+private:
+	void run();
+
+	std::mutex mLock;
+	std::condition_variable mWake;
+	std::deque<Task> mQueue;
+	bool mStopping;
+	std::vector<std::thread> mThreads;
+};
+
+#endif // EXECUTOR_H_
@@ -1,11 +1,50 @@
 #include "fs_blob.h"
+#include "object_sizes.h"
+#include "object_store.h"
 #include <cstring>
 
 const int FSBlob::Type = 0x472bca9;
 
-FSBlob::FSBlob(GitBlob && blob, git_filemode_t mode) : mBlob(std::move(blob)), mMode(mode)
+namespace
 {
-	mInode = inodeFromOid(mBlob.id());
+
+// Blobs at least this large are streamed instead of inflated as a whole
+constexpr off_t StreamThreshold = 16 << 20;
+
+int copyContent(const BlobCache::Pin & content, char * buffer, size_t bufsize, off_t offset)
+{
+	size_t contentSize = content.size();
+
+	if (!content || offset < 0)
+		return -EIO;
+
+	if (size_t(offset) >= contentSize)
+		return 0;
+
+	size_t contentLen = contentSize - offset;
+	if (contentLen > bufsize)
+		contentLen = bufsize;
+
+	std::memcpy(buffer, (const char *)content.data() + offset, contentLen);
+	return contentLen;
+}
+
+} // namespace
+
+int FSBlob::Handle::read(char * buffer, size_t bufsize, off_t offset)
+{
+	if (mStream)
+	{
+		std::lock_guard<std::mutex> guard(mStreamLock);
+		return mStream->read(buffer, bufsize, offset);
+	}
+
+	return copyContent(mPin, buffer, bufsize, offset);
+}
+
+FSBlob::FSBlob(const GitRepositoryView & repo, const git_oid * oid, git_filemode_t mode) : mRepository(repo), mOid(*oid), mMode(mode)
+{
+	mInode = inodeFromOid(&mOid);
 }
 
 FSBlob::~FSBlob()
@@ -25,7 +64,7 @@ std::string_view FSBlob::name() const
 int FSBlob::fillStat(struct stat *st) const
 {
 	st->st_nlink = 2;
-	st->st_size = mBlob.size();
+	st->st_size = ObjectSizes::objectSize(mRepository, &mOid);
 	st->st_ino = mInode;
 
 	if (mMode == GIT_FILEMODE_BLOB_EXECUTABLE)
@@ -38,21 +77,59 @@ int FSBlob::fillStat(struct stat *st) const
 	return 0;
 }
 
-int FSBlob::read(char * buffer, size_t bufsize, off_t offset) const
+bool FSBlob::isImmutable() const
 {
-	const void * content = mBlob.content();
-	size_t contentSize = mBlob.size();
+	return true;
+}
 
-	if (!content || offset < 0)
-		return -EIO;
+BlobCache::Pin FSBlob::pin() const
+{
+	return BlobCache::instance().get(mRepository, &mOid);
+}
 
-	if (size_t(offset) >= contentSize)
-		return 0;
+std::unique_ptr<FSBlob::Handle> FSBlob::open() const
+{
+	std::unique_ptr<Handle> handle(new Handle());
 
-	size_t contentLen = contentSize - offset;
-	if (contentLen > bufsize)
-		contentLen = bufsize;
+	if (ObjectSizes::objectSize(mRepository, &mOid) >= StreamThreshold)
+		handle->mStream = BlobStream::open(mRepository, &mOid);
 
-	std::memcpy(buffer, (const char *)content + offset, contentLen);
-	return contentLen;
+	// Small or deltified blobs are kept resident for as long as the file is open
+	if (!handle->mStream)
+		handle->mPin = pin();
+
+	return handle;
+}
+
+int FSBlob::openBacking() const
+{
+	ObjectStore & store = ObjectStore::instance();
+
+	int fd = store.open(mOid);
+	if (fd >= 0)
+		return fd;
+
+	off_t size = ObjectSizes::objectSize(mRepository, &mOid);
+	if (!store.wanted(mOid, size))
+		return -1;
+
+	// Inflating and writing a large blob takes long, this open reads from the
+	// stream or the blob cache and later ones from the stored file
+	GitRepositoryView repo = mRepository;
+	git_oid oid = mOid;
+	git_filemode_t mode = mMode;
+	store.storeLater(mOid, size, [repo, oid, mode] () -> ObjectStore::ReadFunction
+	{
+		std::shared_ptr<Handle> handle = FSBlob(repo, &oid, mode).open();
+		return [handle] (char * buffer, size_t bufsize, off_t offset) -> int
+		{
+			return handle->read(buffer, bufsize, offset);
+		};
+	});
+	return -1;
+}
+
+int FSBlob::read(char * buffer, size_t bufsize, off_t offset) const
+{
+	return copyContent(pin(), buffer, bufsize, offset);
 }
@@ -2,11 +2,33 @@
 #define FS_BLOB_H_
 
 #include "fs_entry.h"
+#include "blob_cache.h"
+#include "blob_stream.h"
+#include <memory>
+#include <mutex>
 
 class FSBlob : public FSEntry
 {
 public:
-	FSBlob(GitBlob && blob, git_filemode_t mode);
+	// Per open file state, either a pinned cache entry or a seekable stream
+	class Handle
+	{
+	public:
+		int read(char * buffer, size_t bufsize, off_t offset);
+
+		// Resident content, stays valid while the handle exists. Null for streams.
+		inline const char * data() const { return (mPin ? static_cast<const char *>(mPin.data()) : nullptr); }
+		inline size_t size() const { return (mPin ? mPin.size() : 0); }
+
+	private:
+		friend class FSBlob;
+		BlobCache::Pin mPin;
+		std::unique_ptr<BlobStream> mStream;
+		std::mutex mStreamLock;
+	};
+
+public:
+	FSBlob(const GitRepositoryView & repo, const git_oid * oid, git_filemode_t mode);
 	~FSBlob();
 
 	static const int Type;
@@ -14,10 +36,21 @@ public:
 
 	std::string_view name() const override;
 	int fillStat(struct stat *st) const override;
+	bool isImmutable() const override;
 	int read(char * buffer, size_t bufsize, off_t offset) const override;
 
+	inline const git_oid & id() const { return mOid; }
+
+	BlobCache::Pin pin() const;
+	std::unique_ptr<Handle> open() const;
+
+	// Descriptor of the content in the object store for kernel passthrough,
+	// queues the blob to be stored once it is wanted there. -1 if it isn't stored.
+	int openBacking() const;
+
 private:
-	GitBlob mBlob;
+	GitRepositoryView mRepository;
+	git_oid mOid;
 	git_filemode_t mMode;
 	InodeType mInode;
 };
@@ -1,12 +1,17 @@
 #include "fs_branch.h"
 #include "fs_commit_link.h"
-#include "git_wrappers.h"
+#include "fs_root.h"
+#include "ref_index.h"
+#include "repository_pool.h"
+#include <iostream>
 
 const int FSBranch::Type = 0x710ffe;
 
-FSBranch::FSBranch(std::string name, unsigned int depth)
+FSBranch::FSBranch(FSRoot & root, std::string name, std::string ref, unsigned int depth) :
+	mRoot(root), mPopulated(false), mIsRef(false), mHeadsValid(false), mTarget{}, mPeeled{}, mHasPeeled(false)
 {
 	mName.swap(name);
+	mRef.swap(ref);
 	mDepth = depth;
 }
 
@@ -25,40 +30,127 @@ std::string_view FSBranch::name() const
 	return std::string_view(mName);
 }
 
-int FSBranch::setBranch(GitRepository & repo, const char *branch)
+int FSBranch::getChild(std::string_view & name, std::shared_ptr<FSEntry> & target, bool allowUnlinked) const
 {
-	git_oid oid;
-	int retval;
+	populate();
+	return FSPseudoDirectory::getChild(name, target, allowUnlinked);
+}
+
+int FSBranch::enumerateChildren(const EnumerateFunction & callback, off_t start, struct stat *st) const
+{
+	populate();
+	return FSPseudoDirectory::enumerateChildren(callback, start, st);
+}
+
+void FSBranch::populate() const
+{
+	if (mPopulated.load(std::memory_order_acquire))
+		return;
+
+	std::lock_guard<std::mutex> guard(gWriteLock);
+	if (mPopulated.load(std::memory_order_relaxed))
+		return;
+
+	std::shared_ptr<const RefIndex> refs = mRoot.refs();
+	FSBranch * self = const_cast<FSBranch *>(this);
+	self->fillDraft(*refs, nullptr);
+	self->publishDraft();
+	self->mPopulated.store(true, std::memory_order_release);
+}
+
+void FSBranch::fillDraft(const RefIndex & refs, Changes * changes)
+{
+	startDraft();
 
-	mBranch.clear();
-	mHead.free();
+	if (mIsRef)
+		updateHeads(changes);
 
-	retval = repo.targetByName(&oid, branch);
-	if (retval == 0)
+	// One child per next segment; a whole subdirectory is skipped at once,
+	// so a namespace of many refs costs a binary search per child
+	std::string prefix = mRef + '/';
+	size_t index = refs.lowerBound(prefix);
+	size_t end = refs.prefixEnd(index, prefix);
+	while (index < end)
 	{
-		GitObject object = repo.resolveObject(&oid);
-		GitObject peeled = object.peel(GIT_OBJECT_COMMIT);
-		GitCommit commit = repo.resolveCommit(peeled.id());
-		if (commit)
+		std::string_view remainder = refs.name(index).substr(prefix.size());
+		auto nextSep = remainder.find('/');
+		std::string_view segment = remainder.substr(0, nextSep);
+
+		FSEntryPtr entry = draftChild(segment);
+		if (!entry)
+			entry = std::make_shared<FSBranch>(mRoot, std::string(segment), prefix + std::string(segment), mDepth + 1);
+
+		FSBranch * branch = entry->cast<FSBranch>();
+		if (!branch)
 		{
-			mBranch = branch;
-			mHead = std::move(commit);
-			updateHeads();
+			std::cerr << "Name collision when building reference directory structure" << std::endl;
+			++index;
+			continue;
+		}
+
+		if (nextSep == remainder.npos)
+		{
+			branch->setTarget(refs, index);
+			++index;
 		}
 		else
 		{
-			retval = GIT_ENOTFOUND;
+			branch->clearTarget();
+			index = refs.prefixEnd(index, refs.name(index).substr(0, prefix.size() + nextSep + 1));
 		}
+
+		addDraftChild(entry);
+		if (branch->mPopulated.load(std::memory_order_relaxed))
+			branch->fillDraft(refs, changes);
 	}
+}
+
+void FSBranch::setTarget(const RefIndex & refs, size_t index)
+{
+	if (mIsRef && mTarget == refs.target(index))
+		return;
 
-	return retval;
+	mIsRef = true;
+	mHeadsValid = false;
+	mTarget = refs.target(index);
+	mHasPeeled = (refs.peeled(index) != nullptr);
+	if (mHasPeeled)
+		mPeeled = *refs.peeled(index);
 }
 
-void FSBranch::updateHeads()
+void FSBranch::clearTarget()
 {
-	FSCommitLink *link;
+	mIsRef = false;
+	mHeadsValid = false;
+}
+
+void FSBranch::updateHeads(Changes * changes)
+{
+	if (mHeadsValid)
+	{
+		keepHeads();
+		return;
+	}
+
+	GitRepositoryView repo = RepositoryPool::local(mRoot.repo());
+	GitCommit head;
+	if (mHasPeeled)
+	{
+		head = repo.resolveCommit(&mPeeled);
+	}
+	else
+	{
+		GitObject object = repo.resolveObject(&mTarget);
+		GitObject peeled = object.peel(GIT_OBJECT_COMMIT);
+		head = repo.resolveCommit(peeled.id());
+	}
 
-	const int nrParents = mHead.parentCount();
+	// Refs to trees or blobs just don't get links
+	mHeadsValid = true;
+	if (!head)
+		return;
+
+	const int nrParents = head.parentCount();
 	for (int i = -1; i < nrParents; ++i)
 	{
 		std::string newName;
@@ -69,19 +161,28 @@ void FSBranch::updateHeads()
 		if (i > 0)
 			newName += (i + '1');
 
-		std::string_view name(newName);
-		FSEntryPtr entry;
-		getChild(name, entry, true);
+		FSEntryPtr entry = draftChild(newName);
 		if (!entry)
-		{
-			entry = std::make_shared<FSCommitLink>(std::move(newName), mDepth);
-			addChild(entry);
-		}
+			entry = std::make_shared<FSCommitLink>(std::move(newName), mDepth, mRoot.repo());
 
-		link = entry->cast<FSCommitLink>();
-		if (link)
-		{
-			link->updateFromCommit(mHead, i);
-		}
+		FSCommitLink *link = entry->cast<FSCommitLink>();
+		if (!link)
+			continue;
+
+		bool moved = false;
+		link->setTarget(*head.id(), i, &moved);
+		addDraftChild(entry);
+		if (moved && changes)
+			changes->entries.push_back(link);
+	}
+}
+
+void FSBranch::keepHeads()
+{
+	std::shared_ptr<const EntryMap> entries = snapshot();
+	for (const auto & iter : *entries)
+	{
+		if (iter.second->cast<FSCommitLink>())
+			addDraftChild(iter.second);
 	}
 }
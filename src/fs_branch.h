@@ -2,12 +2,25 @@
 #define FS_BRANCH_H_
 
 #include "fs_pseudo_directory.h"
+#include "git_wrappers.h"
+#include <atomic>
+#include <string>
 
-class GitRepository;
+class FSRoot;
+class RefIndex;
+
+/*
+ * Directory of a ref name prefix, like refs/heads/feature. If the prefix is
+ * a ref itself it holds HEAD links to the commit it points at and its
+ * parents, and it holds a subdirectory per next segment of the refs below
+ * it. Children are built from the ref index of the root the first time the
+ * directory is looked into; directories nobody looks at never cost more
+ * than their own node.
+ */
 class FSBranch : public FSPseudoDirectory
 {
 public:
-	FSBranch(std::string name, unsigned int depth);
+	FSBranch(FSRoot & root, std::string name, std::string ref, unsigned int depth);
 	~FSBranch();
 
 	static const int Type;
@@ -15,16 +28,37 @@ public:
 
 	std::string_view name() const override;
 
-	int setBranch(GitRepository & repo, const char *branch);
+	int getChild(std::string_view & name, std::shared_ptr<FSEntry> & target, bool allowUnlinked) const override;
+	int enumerateChildren(const EnumerateFunction & callback, off_t start, struct stat *st) const override;
+
+protected:
+	// Builds the draft of this directory and of the populated ones below it
+	// from refs, only to be used while holding gWriteLock
+	void fillDraft(const RefIndex & refs, Changes * changes);
+
+	void populate() const;
+
+	FSRoot & mRoot;
+	std::atomic<bool> mPopulated;
 
 private:
-	void updateHeads();
+	void setTarget(const RefIndex & refs, size_t index);
+	void clearTarget();
+	void updateHeads(Changes * changes);
+	void keepHeads();
 
 private:
 	std::string mName;
-	std::string mBranch;
-	GitCommit mHead;
+	std::string mRef;
 	unsigned int mDepth;
+
+	// What the ref points at and whether the HEAD links follow it already,
+	// only touched while holding gWriteLock
+	bool mIsRef;
+	bool mHeadsValid;
+	git_oid mTarget;
+	git_oid mPeeled;
+	bool mHasPeeled;
 };
 
 #endif // FS_BRANCH_H_
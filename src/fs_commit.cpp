@@ -2,7 +2,7 @@
 
 const int FSCommit::Type = 0xf3123ae;
 
-FSCommit::FSCommit(GitCommit && commit) : FSTree(commit.tree()), mCommit(std::move(commit))
+FSCommit::FSCommit(GitCommit && commit) : FSTree(commit.owner(), TreeNode::get(commit.owner(), commit.treeId())), mCommit(std::move(commit))
 {
 }
 
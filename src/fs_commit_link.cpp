@@ -1,9 +1,10 @@
 #include "fs_commit_link.h"
+#include "repository_pool.h"
 #include <cstring>
 
 const int FSCommitLink::Type = 0x1b64fe;
 
-FSCommitLink::FSCommitLink(std::string name, unsigned int depth)
+FSCommitLink::FSCommitLink(std::string name, unsigned int depth, GitRepository & repo) : mRepository(repo)
 {
 	mName.swap(name);
 	mDepth = depth;
@@ -25,9 +26,11 @@ std::string_view FSCommitLink::name() const
 
 int FSCommitLink::fillStat(struct stat *st) const
 {
+	std::shared_ptr<const std::string> target = link();
+
 	st->st_ino = mInode;
 	st->st_mode = 0444 | S_IFLNK;
-	st->st_size = mLink.size();
+	st->st_size = (target ? target->size() : 0);
 	st->st_blocks = 1;
 	st->st_blksize = 512;
 	return 0;
@@ -38,33 +41,74 @@ int FSCommitLink::readLink(char * buffer, size_t bufsize) const
 	if (!buffer || !bufsize)
 		return -EINVAL;
 
-	if (mLink.empty())
+	std::shared_ptr<const std::string> target = link();
+	if (!target || target->empty())
 		return -EIO;
 
-	size_t needed = mLink.size() + 1;
-	std::memcpy(buffer, mLink.data(), std::min(needed, bufsize));
+	size_t needed = target->size() + 1;
+	std::memcpy(buffer, target->data(), std::min(needed, bufsize));
 	buffer[bufsize-1] = 0;
 	return 0;
 }
 
-void FSCommitLink::updateFromCommit(const GitCommit & commit, int parent)
+void FSCommitLink::setTarget(const git_oid & commit, int parent, bool * moved)
 {
-	mLink.clear();
-	mLink.reserve(64);
+	auto next = std::make_shared<Target>();
+	next->commit = commit;
+	next->parent = parent;
 
-	const git_oid * oid = (parent == -1 ? commit.id() : commit.parentId(parent));
-	if (oid)
-	{
-		GitObject object = commit.owner().resolveObject(oid, GIT_OBJECT_COMMIT);
+	// Readers see either the old or the new target, never a partial one
+	std::shared_ptr<const Target> previous = std::atomic_exchange(&mTarget, std::shared_ptr<const Target>(next));
+	if (!moved)
+		return;
+
+	// A target nobody looked at can't be cached by the kernel
+	std::shared_ptr<const std::string> seen = (previous ? std::atomic_load(&previous->link) : nullptr);
+	if (!seen)
+		*moved = false;
+	else if (previous->commit == commit && previous->parent == parent)
+		*moved = false;
+	else
+		*moved = (*seen != *link());
+}
 
-		for (unsigned int i = 0; i < mDepth; ++i)
-			mLink += "../";
-		mLink += object.shortId();
+std::shared_ptr<const std::string> FSCommitLink::link() const
+{
+	std::shared_ptr<const Target> target = std::atomic_load(&mTarget);
+	if (!target)
+		return nullptr;
 
-		setUnlinked(false);
+	std::shared_ptr<const std::string> link = std::atomic_load(&target->link);
+	if (!link)
+	{
+		// Racing readers compute the same string, either copy will do
+		link = resolve(*target);
+		std::atomic_store(&target->link, link);
 	}
-	else
+	return link;
+}
+
+std::shared_ptr<const std::string> FSCommitLink::resolve(const Target & target) const
+{
+	GitRepositoryView repo = RepositoryPool::local(mRepository);
+
+	const git_oid * oid = &target.commit;
+	GitCommit commit;
+	if (target.parent >= 0)
 	{
-		setUnlinked(true);
+		commit = repo.resolveCommit(oid);
+		oid = commit.parentId(target.parent);
 	}
+
+	GitObject object = repo.resolveObject(oid, GIT_OBJECT_COMMIT);
+
+	auto link = std::make_shared<std::string>();
+	if (!object)
+		return link;
+
+	link->reserve(64);
+	for (unsigned int i = 0; i < mDepth; ++i)
+		*link += "../";
+	*link += object.shortId();
+	return link;
 }
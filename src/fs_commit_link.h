@@ -3,12 +3,18 @@
 
 #include "fs_pseudo_entry.h"
 #include "git_wrappers.h"
+#include <memory>
 #include <string>
 
+/*
+ * Symbolic link from a ref to a commit or one of its parents. The target
+ * path holds an abbreviated id, which is only computed once the link is
+ * first read or stat'ed; most links of a big ref namespace never are.
+ */
 class FSCommitLink : public FSPseudoEntry
 {
 public:
-	FSCommitLink(std::string name, unsigned int depth);
+	FSCommitLink(std::string name, unsigned int depth, GitRepository & repo);
 	~FSCommitLink();
 
 	static const int Type;
@@ -18,12 +24,26 @@ public:
 	int fillStat(struct stat *st) const override;
 	int readLink(char * buffer, size_t bufsize) const override;
 
-	void updateFromCommit(const GitCommit & commit, int parent = -1);
+	// Points the link at commit, or its parent-th parent when parent isn't
+	// -1. Moved tells whether a target that was handed out changed.
+	void setTarget(const git_oid & commit, int parent = -1, bool * moved = nullptr);
 
 private:
+	struct Target
+	{
+		git_oid commit;
+		int parent;
+		// Filled on first use, shared by everyone reading this target
+		mutable std::shared_ptr<const std::string> link;
+	};
+
+	std::shared_ptr<const std::string> link() const;
+	std::shared_ptr<const std::string> resolve(const Target & target) const;
+
 	std::string mName;
-	std::string mLink;
+	std::shared_ptr<const Target> mTarget;
 	unsigned int mDepth;
+	GitRepository & mRepository;
 };
 
 #endif // FS_COMMIT_LINK_H_
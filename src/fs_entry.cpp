@@ -5,6 +5,11 @@ FSEntry::InodeType FSEntry::inodeFromOid(const git_oid * oid)
 	return (oid ? *((const FSEntry::InodeType*)oid) & FSRealMask : 0);
 }
 
+bool FSEntry::isImmutable() const
+{
+	return false;
+}
+
 bool FSEntry::isUnlinked() const
 {
 	return false;
@@ -41,6 +46,32 @@ int FSEntry::enumerateChildren(const EnumerateFunction & callback, off_t start,
 	return -ENOTDIR;
 }
 
+std::shared_ptr<const DirentList> FSEntry::listChildren() const
+{
+	// Snapshot of whatever enumerateChildren yields, for mutable directories
+	auto list = std::make_shared<DirentList>();
+	struct stat st = {};
+	st.st_nlink = 1;
+
+	int retval = enumerateChildren([&list] (const char *name, off_t idx, struct stat *st) -> int
+	{
+		list->add(name, *st);
+		return 0;
+	}, 0, &st);
+
+	return (retval == 0 ? list : nullptr);
+}
+
+uint64_t FSEntry::generation() const
+{
+	return 0;
+}
+
+bool FSEntry::isMissStable(std::string_view name) const
+{
+	return true;
+}
+
 int FSEntry::readLink(char * buffer, size_t bufsize) const
 {
 	return -EINVAL;
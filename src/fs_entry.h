@@ -7,6 +7,7 @@
 #include <string_view>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include "dirent_list.h"
 #include "git_wrappers.h"
 
 class FSEntry
@@ -38,6 +39,9 @@ public:
 	virtual std::string_view name() const = 0;
 	virtual int fillStat(struct stat *st) const = 0;
 
+	/* Content and children never change, true for everything inside a commit */
+	virtual bool isImmutable() const;
+
 	/* Optional support for unlinking entries */
 	virtual bool isUnlinked() const;
 	virtual int setUnlinked(bool unlinked);
@@ -48,6 +52,12 @@ public:
 	virtual int addChild(const std::shared_ptr<FSEntry> & entry, bool allowReplace = false);
 	virtual int removeChild(const std::string_view & name);
 	virtual int enumerateChildren(const EnumerateFunction & callback, off_t start, struct stat *st) const;
+	virtual std::shared_ptr<const DirentList> listChildren() const;
+
+	/* Changes whenever the set of children changes, constant for immutable entries */
+	virtual uint64_t generation() const;
+	/* Whether a name that isn't found stays missing until the generation changes */
+	virtual bool isMissStable(std::string_view name) const;
 
 	/* Optional support for symbolic links */
 	virtual int readLink(char * buffer, size_t bufsize) const;
@@ -1,8 +1,8 @@
 #include "fs_pseudo_directory.h"
 
-std::recursive_mutex FSPseudoDirectory::gLock;
+std::mutex FSPseudoDirectory::gWriteLock;
 
-FSPseudoDirectory::FSPseudoDirectory()
+FSPseudoDirectory::FSPseudoDirectory() : mEntries(std::make_shared<EntryMap>()), mGeneration(1)
 {
 }
 
@@ -18,15 +18,25 @@ int FSPseudoDirectory::fillStat(struct stat *st) const
 	return 0;
 }
 
-int FSPseudoDirectory::getChild(std::string_view & name, std::shared_ptr<FSEntry> & target, bool allowUnlinked) const
+std::shared_ptr<const FSPseudoDirectory::EntryMap> FSPseudoDirectory::snapshot() const
 {
-	std::lock_guard<std::recursive_mutex> guard(gLock);
+	return std::atomic_load(&mEntries);
+}
+
+void FSPseudoDirectory::replaceSnapshot(std::shared_ptr<const EntryMap> entries)
+{
+	std::atomic_store(&mEntries, std::move(entries));
+	++mGeneration;
+}
 
+int FSPseudoDirectory::getChild(std::string_view & name, std::shared_ptr<FSEntry> & target, bool allowUnlinked) const
+{
 	auto nextSep = name.find('/');
 	std::string_view segment = name.substr(0, nextSep);
 
-	auto iter = mEntries.find(segment);
-	if (iter == mEntries.cend() || (!allowUnlinked && iter->second->isUnlinked()))
+	std::shared_ptr<const EntryMap> entries = snapshot();
+	auto iter = entries->find(segment);
+	if (iter == entries->cend() || (!allowUnlinked && iter->second->isUnlinked()))
 		return -ENOENT;
 
 	name = (nextSep == name.npos ? std::string_view() : name.substr(nextSep+1));
@@ -36,48 +46,50 @@ int FSPseudoDirectory::getChild(std::string_view & name, std::shared_ptr<FSEntry
 
 int FSPseudoDirectory::addChild(const std::shared_ptr<FSEntry> & entry, bool allowReplace)
 {
-	std::lock_guard<std::recursive_mutex> guard(gLock);
+	std::lock_guard<std::mutex> guard(gWriteLock);
 
 	std::string_view name = entry->name();
-	auto iter = mEntries.find(name);
-	if (iter == mEntries.end())
+	auto entries = std::make_shared<EntryMap>(*snapshot());
+	auto iter = entries->find(name);
+	if (iter == entries->end())
 	{
-		mEntries.insert(std::make_pair(name, entry));
-		return 0;
+		entries->insert(std::make_pair(name, entry));
 	}
 	else if (allowReplace)
 	{
-		iter->second = entry;
-		return 0;
+		// The key views the name of the replaced entry
+		entries->erase(iter);
+		entries->insert(std::make_pair(name, entry));
 	}
 	else
 	{
 		return -EEXIST;
 	}
+
+	replaceSnapshot(std::move(entries));
+	return 0;
 }
 
 int FSPseudoDirectory::removeChild(const std::string_view & name)
 {
-	std::lock_guard<std::recursive_mutex> guard(gLock);
+	std::lock_guard<std::mutex> guard(gWriteLock);
 
-	auto iter = mEntries.find(name);
-	if (iter == mEntries.end())
-	{
+	auto entries = std::make_shared<EntryMap>(*snapshot());
+	auto iter = entries->find(name);
+	if (iter == entries->end())
 		return -ENOENT;
-	}
-	else
-	{
-		mEntries.erase(iter);
-		return 0;
-	}
+
+	entries->erase(iter);
+	replaceSnapshot(std::move(entries));
+	return 0;
 }
 
 int FSPseudoDirectory::enumerateChildren(const EnumerateFunction & callback, off_t start, struct stat *st) const
 {
-	std::lock_guard<std::recursive_mutex> guard(gLock);
+	std::shared_ptr<const EntryMap> entries = snapshot();
 
-	auto iter = mEntries.cbegin();
-	auto end = mEntries.cend();
+	auto iter = entries->cbegin();
+	auto end = entries->cend();
 	int retval = 0;
 	off_t index = 0;
 
@@ -98,37 +110,87 @@ int FSPseudoDirectory::enumerateChildren(const EnumerateFunction & callback, off
 	return 0;
 }
 
-int FSPseudoDirectory::setUnlinked(bool unlinked)
+uint64_t FSPseudoDirectory::generation() const
 {
-	mUnlinked = unlinked;
-	if (unlinked)
-	{
-		std::lock_guard<std::recursive_mutex> guard(gLock);
-		for (auto & iter : mEntries)
-			iter.second->setUnlinked(true);
-	}
+	return mGeneration;
+}
 
-	return 0;
+void FSPseudoDirectory::startDraft()
+{
+	mDraft.reset(new EntryMap());
+}
+
+FSEntryPtr FSPseudoDirectory::draftChild(std::string_view name) const
+{
+	// Prefer what this rebuild added already, then reuse the published node
+	auto iter = mDraft->find(name);
+	if (iter != mDraft->end())
+		return iter->second;
+
+	std::shared_ptr<const EntryMap> entries = snapshot();
+	auto published = entries->find(name);
+	if (published != entries->end())
+		return published->second;
+
+	return FSEntryPtr();
+}
+
+void FSPseudoDirectory::addDraftChild(const FSEntryPtr & entry)
+{
+	mDraft->insert_or_assign(entry->name(), entry);
 }
 
-size_t FSPseudoDirectory::purgeUnlinked()
+void FSPseudoDirectory::publishDraft(Changes * changes)
 {
-	size_t count = 0;
+	if (!mDraft)
+		return;
 
-	std::lock_guard<std::recursive_mutex> guard(gLock);
+	// Children first, so a reader that sees the new map of this directory
+	// also sees the new maps of everything below it
+	for (auto & iter : *mDraft)
+	{
+		FSPseudoDirectory * directory = dynamic_cast<FSPseudoDirectory *>(iter.second.get());
+		if (directory)
+			directory->publishDraft(changes);
+	}
 
-	auto next = mEntries.begin();
-	auto end = mEntries.end();
-	for (decltype(next) iter = next; iter != end; iter = next)
+	// Both maps are sorted by name, walk them side by side
+	std::shared_ptr<const EntryMap> current = snapshot();
+	bool changed = false;
+	auto lhs = current->cbegin();
+	auto rhs = mDraft->cbegin();
+	while (lhs != current->cend() || rhs != mDraft->cend())
 	{
-		std::advance(next, 1);
-		count += iter->second->purgeUnlinked();
-		if (iter->second->isUnlinked())
+		std::string_view name;
+		if (rhs == mDraft->cend() || (lhs != current->cend() && lhs->first < rhs->first))
+			name = (lhs++)->first;
+		else if (lhs == current->cend() || rhs->first < lhs->first)
+			name = (rhs++)->first;
+		else
 		{
-			mEntries.erase(iter);
-			++count;
+			bool same = (lhs->second == rhs->second);
+			name = rhs->first;
+			++lhs;
+			++rhs;
+			if (same)
+				continue;
 		}
+
+		changed = true;
+		if (!changes)
+			break;
+		changes->names.emplace_back(this, std::string(name));
 	}
 
-	return count;
+	// Unchanged directories keep their generation so their lookups stay cached
+	if (changed)
+	{
+		if (changes)
+			changes->entries.push_back(this);
+		replaceSnapshot(std::shared_ptr<const EntryMap>(mDraft.release()));
+	}
+	else
+	{
+		mDraft.reset();
+	}
 }
@@ -2,10 +2,35 @@
 #define FS_PSEUDO_DIRECTORY_H_
 
 #include "fs_pseudo_entry.h"
+#include <atomic>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
+/*
+ * Directory of pseudo entries whose children are published as immutable
+ * snapshots. Readers load the current snapshot without taking any lock.
+ * Writers are serialized by a single lock and either replace the snapshot
+ * for a single change, or fill a private draft that is published once a
+ * whole rebuild is finished.
+ */
 class FSPseudoDirectory : public FSPseudoEntry
 {
+public:
+	using EntryMap = std::map<std::string_view, std::shared_ptr<FSEntry>>;
+
+	// What publishing a rebuild changed, for telling the kernel precisely
+	struct Changes
+	{
+		// Names added to, removed from or replaced in a directory
+		std::vector<std::pair<const FSEntry *, std::string>> names;
+		// Entries whose attributes or link target changed
+		std::vector<const FSEntry *> entries;
+	};
+
 public:
 	FSPseudoDirectory();
 	~FSPseudoDirectory();
@@ -16,13 +41,24 @@ public:
 	int addChild(const std::shared_ptr<FSEntry> & entry, bool allowReplace = false) override;
 	int removeChild(const std::string_view & name) override;
 	int enumerateChildren(const EnumerateFunction & callback, off_t start, struct stat *st) const override;
+	uint64_t generation() const override;
 
-	int setUnlinked(bool unlinked) override;
-	size_t purgeUnlinked() override;
+	/* Drafts, only to be used while holding gWriteLock */
+	void startDraft();
+	FSEntryPtr draftChild(std::string_view name) const;
+	void addDraftChild(const FSEntryPtr & entry);
+	void publishDraft(Changes * changes = nullptr);
 
 protected:
-	static std::recursive_mutex gLock;
-	std::map<std::string_view, std::shared_ptr<FSEntry>> mEntries;
+	std::shared_ptr<const EntryMap> snapshot() const;
+	void replaceSnapshot(std::shared_ptr<const EntryMap> entries);
+
+	static std::mutex gWriteLock;
+
+private:
+	std::shared_ptr<const EntryMap> mEntries;
+	std::unique_ptr<EntryMap> mDraft;
+	std::atomic<uint64_t> mGeneration;
 };
 
 #endif // FS_PSEUDO_DIRECTORY_H_
@@ -1,6 +1,6 @@
 #include "fs_pseudo_entry.h"
 
-FSPseudoEntry::InodeType FSPseudoEntry::mLastInode;
+std::atomic<FSPseudoEntry::InodeType> FSPseudoEntry::mLastInode;
 
 FSPseudoEntry::FSPseudoEntry()
 {
@@ -2,6 +2,7 @@
 #define FS_PSEUDO_ENTRY_H_
 
 #include "fs_entry.h"
+#include <atomic>
 
 class FSPseudoEntry : public FSEntry
 {
@@ -15,10 +16,10 @@ public:
 
 protected:
 	InodeType mInode;
-	bool mUnlinked;
+	std::atomic<bool> mUnlinked;
 
 private:
-	static InodeType mLastInode;
+	static std::atomic<InodeType> mLastInode;
 };
 
 #endif // FS_PSEUDO_ENTRY_H_
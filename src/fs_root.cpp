@@ -1,11 +1,11 @@
 #include "fs_root.h"
-#include "fs_branch.h"
 #include "fs_commit.h"
-#include <iostream>
+#include "ref_index.h"
+#include "repository_pool.h"
 
 const int FSRoot::Type = 0x9d23a;
 
-FSRoot::FSRoot(GitRepository & repo) : repository(repo)
+FSRoot::FSRoot(GitRepository & repo) : FSBranch(*this, std::string(), "refs", 0), repository(repo), mRefs(std::make_shared<RefIndex>()), mLoads(0), mPublished(0)
 {
 
 }
@@ -23,15 +23,13 @@ std::string_view FSRoot::name() const
 
 int FSRoot::getChild(std::string_view & name, std::shared_ptr<FSEntry> & target, bool allowUnlinked) const
 {
-	std::lock_guard<std::recursive_mutex> guard(gLock);
-
 	auto nextSep = name.find('/');
 	std::string_view segment = name.substr(0, nextSep);
 
 	git_oid oid;
 	if (git_oid_fromstrn(&oid, segment.data(), segment.length()) == 0)
 	{
-		GitCommit commit = repository.resolveCommit(&oid, segment.length());
+		GitCommit commit = RepositoryPool::local(repository).resolveCommit(&oid, segment.length());
 		if (commit)
 		{
 			name = (nextSep == name.npos ? std::string_view() : name.substr(nextSep+1));
@@ -40,69 +38,38 @@ int FSRoot::getChild(std::string_view & name, std::shared_ptr<FSEntry> & target,
 		}
 	}
 
-	return FSPseudoDirectory::getChild(name, target, allowUnlinked);
+	return FSBranch::getChild(name, target, allowUnlinked);
 }
 
-void FSRoot::rebuildRefs()
+bool FSRoot::isMissStable(std::string_view name) const
 {
-	std::lock_guard<std::recursive_mutex> guard(gLock);
-
-	setUnlinked(true);
-	setUnlinked(false);
-
-	repository.forEachReference([this] (const char *refname) -> int
-	{
-		std::string_view ref(refname);
-		if (ref.substr(0, 5) != std::string_view("refs/", 5))
-			return 0;
-
-		ref = ref.substr(5);
-		if (ref.empty())
-			return 0;
-
-		FSEntry * current = this;
-		unsigned int depth = 0;
-		while (true)
-		{
-			++depth;
-
-			auto nextSep = ref.find('/');
-			std::string_view segment = ref.substr(0, nextSep);
-			ref = (nextSep == ref.npos ? std::string_view() : ref.substr(nextSep+1));
-
-			FSEntryPtr nextEntry;
-			int retval = current->getChild(segment, nextEntry, true);
-			if (retval == -ENOENT)
-			{
-				nextEntry = std::make_shared<FSBranch>(std::string(segment), depth);
-				current->addChild(nextEntry);
-				retval = 0;
-			}
-
-			if (retval != 0)
-			{
-				std::cerr << "Name collision when building reference directory structure" << std::endl;
-				return 0;
-			}
-
-			current = nextEntry.get();
-			current->setUnlinked(false);
-			if (ref.empty())
-			{
-				FSBranch *branch = current->cast<FSBranch>();
-				if (!branch)
-				{
-					std::cerr << "Type error when building reference directory structure" << std::endl;
-					return 0;
-				}
-
-				branch->setBranch(repository, refname);
-				break;
-			}
-		}
+	// Commit ids are looked up in the object database, which grows without
+	// the refs changing
+	git_oid oid;
+	return (git_oid_fromstrn(&oid, name.data(), name.length()) != 0);
+}
 
-		return 0;
-	});
+std::shared_ptr<const RefIndex> FSRoot::refs() const
+{
+	return std::atomic_load(&mRefs);
+}
 
-	purgeUnlinked();
+void FSRoot::rebuildRefs(Changes * changes)
+{
+	// Reading the refs takes a while for big repositories, do it unlocked.
+	// Of concurrent rebuilds the one that started reading last wins.
+	uint64_t load = ++mLoads;
+	std::shared_ptr<const RefIndex> refs = RefIndex::load(repository.commonDir());
+
+	std::lock_guard<std::mutex> guard(gWriteLock);
+	if (load < mPublished)
+		return;
+	mPublished = load;
+	std::atomic_store(&mRefs, refs);
+
+	// Readers keep seeing the previous refs until the new set is published;
+	// only directories that were looked into are rebuilt
+	fillDraft(*refs, changes);
+	publishDraft(changes);
+	mPopulated.store(true, std::memory_order_release);
 }
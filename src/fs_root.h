@@ -1,10 +1,15 @@
 #ifndef FS_ROOT_H_
 #define FS_ROOT_H_
 
-#include "fs_pseudo_directory.h"
+#include "fs_branch.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
 
 class GitRepository;
-class FSRoot : public FSPseudoDirectory
+class RefIndex;
+
+class FSRoot : public FSBranch
 {
 public:
 	FSRoot(GitRepository & repo);
@@ -14,11 +19,21 @@ public:
 
 	std::string_view name() const override;
 	int getChild(std::string_view & name, std::shared_ptr<FSEntry> & target, bool allowUnlinked) const override;
+	bool isMissStable(std::string_view name) const override;
+
+	inline GitRepository & repo() const { return repository; }
+	std::shared_ptr<const RefIndex> refs() const;
 
-	void rebuildRefs();
+	// Rereads the refs and updates the directories built so far, reusing
+	// the nodes of unchanged refs
+	void rebuildRefs(Changes * changes = nullptr);
 
 private:
 	GitRepository & repository;
+	std::shared_ptr<const RefIndex> mRefs;
+	std::atomic<uint64_t> mLoads;
+	// Load whose refs were published last, guarded by the write lock
+	uint64_t mPublished;
 };
 
 #endif // FS_ROOT_H_
@@ -0,0 +1,57 @@
+#include "fs_tip.h"
+
+const int FSTip::Type = 0x7195ee;
+
+FSTip::FSTip(GitRepository & repo, std::string branch) : FSTipTree(std::string(), nullptr), mRepository(repo), mHead{}
+{
+	mBranch.swap(branch);
+}
+
+FSTip::~FSTip()
+{
+}
+
+int FSTip::type() const
+{
+	return Type;
+}
+
+git_oid FSTip::head() const
+{
+	std::lock_guard<std::mutex> guard(mFollowLock);
+	return mHead;
+}
+
+int FSTip::follow(Changes * changes)
+{
+	// The mount and the ref watcher both follow the branch, one of them
+	// must not switch back to a tip it resolved before the other
+	std::lock_guard<std::mutex> guard(mFollowLock);
+
+	// Short names like "main" or "origin/main" resolve the way git does
+	GitReference ref = mRepository.resolveReference(mBranch.c_str());
+	if (!ref)
+		return GIT_ENOTFOUND;
+
+	git_oid oid;
+	int retval = mRepository.targetByName(&oid, ref.name());
+	if (retval != 0)
+		return retval;
+
+	GitObject object = mRepository.resolveObject(&oid);
+	GitObject peeled = object.peel(GIT_OBJECT_COMMIT);
+	GitCommit commit = mRepository.resolveCommit(peeled.id());
+	if (!commit)
+		return GIT_ENOTFOUND;
+
+	if (current() && *commit.id() == mHead)
+		return 0;
+
+	std::shared_ptr<FSTree> tree = FSTree::forTree(mRepository, commit.treeId());
+	if (!tree)
+		return GIT_ENOTFOUND;
+
+	update(tree, changes);
+	mHead = *commit.id();
+	return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef FS_TIP_H_
+#define FS_TIP_H_
+
+#include "fs_tip_tree.h"
+#include <mutex>
+#include <string>
+
+class GitRepository;
+
+/*
+ * Mount root following the tip of a single branch. Each time the refs
+ * change the branch is resolved again and, if it moved, the tree below is
+ * switched to the tree of the new tip.
+ */
+class FSTip : public FSTipTree
+{
+public:
+	FSTip(GitRepository & repo, std::string branch);
+	~FSTip();
+
+	static const int Type;
+	int type() const override;
+
+	// Resolves the branch and switches to its tip, returns a git error
+	int follow(Changes * changes = nullptr);
+
+	git_oid head() const;
+
+private:
+	GitRepository & mRepository;
+	std::string mBranch;
+	// Serializes follow, so the last branch resolved is the one switched to
+	mutable std::mutex mFollowLock;
+	git_oid mHead;
+};
+
+#endif // FS_TIP_H_
@@ -0,0 +1,158 @@
+#include "fs_tip_tree.h"
+
+const int FSTipTree::Type = 0x71b7ee;
+
+FSTipTree::FSTipTree(std::string name, std::shared_ptr<FSTree> tree) : mTree(std::move(tree)), mGeneration(1)
+{
+	mName.swap(name);
+}
+
+FSTipTree::~FSTipTree()
+{
+}
+
+int FSTipTree::type() const
+{
+	return Type;
+}
+
+std::string_view FSTipTree::name() const
+{
+	return std::string_view(mName);
+}
+
+int FSTipTree::fillStat(struct stat *st) const
+{
+	st->st_ino = mInode;
+	st->st_mode = 0777 | S_IFDIR;
+	st->st_size = 0;
+	st->st_nlink = 1;
+	return 0;
+}
+
+std::shared_ptr<FSTree> FSTipTree::current() const
+{
+	return std::atomic_load(&mTree);
+}
+
+int FSTipTree::getChild(std::string_view & name, std::shared_ptr<FSEntry> & target, bool allowUnlinked) const
+{
+	std::shared_ptr<FSTree> tree = current();
+	const TreeNode * node = (tree ? tree->node().get() : nullptr);
+	if (!node)
+		return -EIO;
+
+	auto nextSep = name.find('/');
+	std::string_view segment = name.substr(0, nextSep);
+
+	size_t index = node->find(segment);
+	if (index == TreeNode::npos)
+		return -ENOENT;
+
+	// Files are the same object in every tip, only directories need a node
+	// of their own that follows the tip
+	if (node->entry(index).mode != GIT_FILEMODE_TREE)
+		return tree->getChild(name, target, allowUnlinked);
+
+	std::lock_guard<std::mutex> guard(mLock);
+
+	// The tip may have moved since, whatever is current now is what a new
+	// subdirectory must start from
+	tree = current();
+	node = tree->node().get();
+	index = node->find(segment);
+	if (index == TreeNode::npos || node->entry(index).mode != GIT_FILEMODE_TREE)
+		return -ENOENT;
+
+	auto iter = mChildren.find(segment);
+	std::shared_ptr<FSTipTree> child = (iter != mChildren.end() ? iter->second.lock() : nullptr);
+	if (!child)
+	{
+		std::shared_ptr<FSTree> subtree = FSTree::forTree(tree->repository(), &node->entry(index).oid);
+		if (!subtree)
+			return -EIO;
+
+		child = std::make_shared<FSTipTree>(std::string(segment), std::move(subtree));
+		mChildren.insert_or_assign(std::string(segment), child);
+	}
+
+	name = (nextSep == name.npos ? std::string_view() : name.substr(nextSep+1));
+	target = std::move(child);
+	return 0;
+}
+
+int FSTipTree::enumerateChildren(const EnumerateFunction & callback, off_t start, struct stat *st) const
+{
+	std::shared_ptr<FSTree> tree = current();
+	return (tree ? tree->enumerateChildren(callback, start, st) : -EIO);
+}
+
+std::shared_ptr<const DirentList> FSTipTree::listChildren() const
+{
+	std::shared_ptr<FSTree> tree = current();
+	return (tree ? tree->listChildren() : nullptr);
+}
+
+uint64_t FSTipTree::generation() const
+{
+	return mGeneration;
+}
+
+void FSTipTree::update(const std::shared_ptr<FSTree> & tree, Changes * changes)
+{
+	std::lock_guard<std::mutex> guard(mLock);
+
+	std::shared_ptr<FSTree> previous = current();
+	const TreeNode * before = (previous ? previous->node().get() : nullptr);
+	const TreeNode * after = (tree ? tree->node().get() : nullptr);
+	if (before == after || (before && after && before->id() == after->id()))
+		return;
+
+	auto changed = [this, changes] (const char * name)
+	{
+		if (changes)
+			changes->names.emplace_back(this, std::string(name));
+	};
+
+	// Work is proportional to the entries of changed trees; trees that kept
+	// their oid are skipped along with everything below them
+	for (size_t i = 0; before && i < before->count(); ++i)
+	{
+		const TreeNode::Entry & entry = before->entry(i);
+		size_t index = (after ? after->find(before->name(i)) : TreeNode::npos);
+		if (index != TreeNode::npos && after->entry(index).oid == entry.oid && after->entry(index).mode == entry.mode)
+			continue;
+
+		auto iter = mChildren.find(std::string_view(before->name(i)));
+		std::shared_ptr<FSTipTree> child = (iter != mChildren.end() ? iter->second.lock() : nullptr);
+
+		// A subdirectory that stays one keeps its node and is switched below
+		if (index != TreeNode::npos && entry.mode == GIT_FILEMODE_TREE && after->entry(index).mode == GIT_FILEMODE_TREE)
+		{
+			std::shared_ptr<FSTree> subtree = (child ? FSTree::forTree(tree->repository(), &after->entry(index).oid) : nullptr);
+			if (subtree)
+			{
+				child->update(subtree, changes);
+				continue;
+			}
+			if (!child)
+				continue;
+		}
+
+		if (iter != mChildren.end())
+			mChildren.erase(iter);
+		changed(before->name(i));
+	}
+
+	// New names may be cached as misses
+	for (size_t i = 0; after && i < after->count(); ++i)
+	{
+		if (!before || before->find(after->name(i)) == TreeNode::npos)
+			changed(after->name(i));
+	}
+
+	std::atomic_store(&mTree, tree);
+	++mGeneration;
+	if (changes)
+		changes->entries.push_back(this);
+}
@@ -0,0 +1,57 @@
+#ifndef FS_TIP_TREE_H_
+#define FS_TIP_TREE_H_
+
+#include "fs_pseudo_directory.h"
+#include "fs_pseudo_entry.h"
+#include "fs_tree.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/*
+ * Directory at a fixed path below a followed branch tip, showing whatever
+ * tree the current tip has at that path. The node stays the same when the
+ * tip moves, so the kernel keeps everything it cached below paths that did
+ * not change; only the names whose object changed are reported. Files and
+ * unchanged trees are shared with every other commit through FSTree.
+ */
+class FSTipTree : public FSPseudoEntry
+{
+public:
+	using Changes = FSPseudoDirectory::Changes;
+
+public:
+	FSTipTree(std::string name, std::shared_ptr<FSTree> tree);
+	~FSTipTree();
+
+	static const int Type;
+	int type() const override;
+
+	std::string_view name() const override;
+	int fillStat(struct stat *st) const override;
+
+	int getChild(std::string_view & name, std::shared_ptr<FSEntry> & target, bool allowUnlinked) const override;
+	int enumerateChildren(const EnumerateFunction & callback, off_t start, struct stat *st) const override;
+	std::shared_ptr<const DirentList> listChildren() const override;
+	uint64_t generation() const override;
+
+	// Switches this directory and the ones below it that exist to tree
+	void update(const std::shared_ptr<FSTree> & tree, Changes * changes);
+
+	// Tree shown at this path right now
+	std::shared_ptr<FSTree> current() const;
+
+private:
+	std::string mName;
+	std::shared_ptr<FSTree> mTree;
+	std::atomic<uint64_t> mGeneration;
+
+	// Subdirectories handed out so far, by name. Serializes switching with
+	// handing out new ones, so none misses a switch.
+	mutable std::mutex mLock;
+	mutable std::map<std::string, std::weak_ptr<FSTipTree>, std::less<>> mChildren;
+};
+
+#endif // FS_TIP_TREE_H_
@@ -1,18 +1,48 @@
 #include "fs_tree.h"
 #include "fs_blob.h"
+#include "object_sizes.h"
+#include "sharded_map.h"
+
+namespace
+{
+
+ShardedMap<git_oid, std::weak_ptr<FSTree>, GitOidHash> gTrees(1 << 16);
+
+} // namespace
 
 const int FSTree::Type = 0xe561ffae;
 
-FSTree::FSTree(GitTree && tree) : mTree(std::move(tree))
+FSTree::FSTree(const GitRepositoryView & repo, std::shared_ptr<const TreeNode> node) : mRepository(repo), mNode(std::move(node))
 {
-	const git_oid * oid = mTree.id();
-	mInode = inodeFromOid(oid);
+	mInode = inodeFromOid(mNode ? &mNode->id() : nullptr);
 }
 
 FSTree::~FSTree()
 {
 }
 
+std::shared_ptr<FSTree> FSTree::forTree(const GitRepositoryView & repo, const git_oid * oid)
+{
+	if (!oid)
+		return nullptr;
+
+	std::weak_ptr<FSTree> existing;
+	if (gTrees.find(*oid, existing))
+	{
+		std::shared_ptr<FSTree> tree = existing.lock();
+		if (tree)
+			return tree;
+	}
+
+	std::shared_ptr<const TreeNode> node = TreeNode::get(repo, oid);
+	if (!node)
+		return nullptr;
+
+	auto tree = std::make_shared<FSTree>(repo, std::move(node));
+	gTrees.insert(*oid, tree);
+	return tree;
+}
+
 int FSTree::type() const
 {
 	return Type;
@@ -32,41 +62,61 @@ int FSTree::fillStat(struct stat *st) const
 	return 0;
 }
 
+bool FSTree::isImmutable() const
+{
+	return true;
+}
+
 int FSTree::getChild(std::string_view & name, std::shared_ptr<FSEntry> & target, bool allowUnlinked) const
 {
+	if (!mNode)
+		return -EIO;
+
+	// Resolve a single segment at a time so every intermediate tree becomes
+	// a node of its own that can be remembered by the lookup cache. Misses
+	// are answered by the name index of the decoded tree, which is shared
+	// by every commit that contains the tree.
+	auto nextSep = name.find('/');
+	std::string_view segment = name.substr(0, nextSep);
+	std::string_view remainder = (nextSep == name.npos ? std::string_view() : name.substr(nextSep+1));
+
+	size_t index = mNode->find(segment);
+	if (index == TreeNode::npos)
+		return -ENOENT;
+
 	int retval = -ENOENT;
 
-	GitTreeEntry entry = mTree.byPath(name.data());
-	if (entry)
+	const TreeNode::Entry & entry = mNode->entry(index);
+	switch (entry.mode)
 	{
-		git_filemode_t mode = entry.mode();
-		switch (mode)
-		{
-			case GIT_FILEMODE_UNREADABLE:
-			case GIT_FILEMODE_COMMIT:
-				retval = -EIO;
-				break;
-			case GIT_FILEMODE_TREE:
+		case GIT_FILEMODE_UNREADABLE:
+		case GIT_FILEMODE_COMMIT:
+			retval = -EIO;
+			break;
+		case GIT_FILEMODE_TREE:
+			target = forTree(mRepository, &entry.oid);
+			if (target)
 			{
-				GitTree tree = mTree.owner().resolveTree(entry.id());
-				name = std::string_view();
-				target = std::make_shared<FSTree>(std::move(tree));
+				name = remainder;
 				retval = 0;
-				break;
 			}
-			case GIT_FILEMODE_BLOB:
-			case GIT_FILEMODE_BLOB_EXECUTABLE:
+			else
 			{
-				GitBlob blob = mTree.owner().resolveBlob(entry.id());
-				name = std::string_view();
-				target = std::make_shared<FSBlob>(std::move(blob), mode);
-				retval = 0;
-				break;
-			}
-			case GIT_FILEMODE_LINK:
 				retval = -EIO;
-				break;
-		}
+			}
+			break;
+		case GIT_FILEMODE_BLOB:
+		case GIT_FILEMODE_BLOB_EXECUTABLE:
+			// Sizes a tree already knows, like one kept in the tree index, spare a header read
+			if (mNode->hasSizes())
+				ObjectSizes::remember(entry.oid, mNode->size(index));
+			name = remainder;
+			target = std::make_shared<FSBlob>(mRepository, &entry.oid, entry.mode);
+			retval = 0;
+			break;
+		case GIT_FILEMODE_LINK:
+			retval = -EIO;
+			break;
 	}
 
 	return retval;
@@ -84,60 +134,27 @@ int FSTree::removeChild(const std::string_view & name)
 
 int FSTree::enumerateChildren(const EnumerateFunction & callback, off_t start, struct stat *st) const
 {
-	off_t index = 0;
+	std::shared_ptr<const DirentList> list = listChildren();
+	if (!list)
+		return -EIO;
 
-	size_t lastId = mTree.entryCount();
-	for (size_t id = 0; id < lastId; ++id)
+	// The listing is indexed, resuming costs nothing
+	size_t count = list->size();
+	for (size_t id = (start > 0 ? start : 0); id < count; ++id)
 	{
-		GitTreeEntryView entry = mTree.byIndex(id);
-		git_filemode_t mode = entry.mode();
-
-		switch (mode)
-		{
-			case GIT_FILEMODE_UNREADABLE:
-			case GIT_FILEMODE_COMMIT:
-				st->st_mode = 0;
-				break;
-			case GIT_FILEMODE_TREE:
-				st->st_mode = 0777 | S_IFDIR;
-				break;
-			case GIT_FILEMODE_BLOB:
-				st->st_mode = 0666 | S_IFREG;
-				break;
-			case GIT_FILEMODE_BLOB_EXECUTABLE:
-				st->st_mode = 0777 | S_IFREG;
-				break;
-			case GIT_FILEMODE_LINK:
-				st->st_mode = 0666 | S_IFLNK;
-				break;
-		}
-
-		if (st->st_mode != 0)
-		{
-			++index;
-			if (index > start)
-			{
-				st->st_ino = inodeFromOid(entry.id());
-				switch (mode)
-				{
-					case GIT_FILEMODE_BLOB:
-					case GIT_FILEMODE_BLOB_EXECUTABLE:
-					case GIT_FILEMODE_LINK:
-					{
-						GitBlob blob = mTree.owner().resolveBlob(entry.id());
-						st->st_nlink = 2;
-						st->st_size = blob.size();
-						break;
-					}
-					default:
-						st->st_nlink = 1;
-						st->st_size = 0;
-						break;
-				}
-				callback(entry.name(), index, st);
-			}
-		}
+		const struct stat & cached = list->stat(id);
+		st->st_ino = cached.st_ino;
+		st->st_mode = cached.st_mode;
+		st->st_nlink = cached.st_nlink;
+		st->st_size = cached.st_size;
+		if (callback(list->name(id), id + 1, st) != 0)
+			break;
 	}
 
 	return 0;
 }
+
+std::shared_ptr<const DirentList> FSTree::listChildren() const
+{
+	return (mNode ? mNode->dirents() : nullptr);
+}
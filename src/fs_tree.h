@@ -3,27 +3,37 @@
 
 #include "fs_entry.h"
 #include "git_wrappers.h"
+#include "tree_node.h"
 
 class FSTree : public FSEntry
 {
 public:
-	FSTree(GitTree && tree);
+	FSTree(const GitRepositoryView & repo, std::shared_ptr<const TreeNode> node);
 	~FSTree();
 
+	// Trees carry no per path state, so all paths showing a tree share one node
+	static std::shared_ptr<FSTree> forTree(const GitRepositoryView & repo, const git_oid * oid);
+
 	static const int Type;
 	int type() const override;
 
 	std::string_view name() const override;
 	int fillStat(struct stat *st) const override;
+	bool isImmutable() const override;
 
 	int getChild(std::string_view & name, std::shared_ptr<FSEntry> & target, bool allowUnlinked) const override;
 	int addChild(const std::shared_ptr<FSEntry> & entry, bool allowReplace = false) override;
 	int removeChild(const std::string_view & name) override;
 	int enumerateChildren(const EnumerateFunction & callback, off_t start, struct stat *st) const override;
+	std::shared_ptr<const DirentList> listChildren() const override;
+
+	inline const GitRepositoryView & repository() const { return mRepository; }
+	inline const std::shared_ptr<const TreeNode> & node() const { return mNode; }
 
 protected:
 	InodeType mInode;
-	GitTree mTree;
+	GitRepositoryView mRepository;
+	std::shared_ptr<const TreeNode> mNode;
 };
 
 #endif // FS_TREE_H_
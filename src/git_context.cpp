@@ -1,32 +1,75 @@
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <utility>
 #include <vector>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <sstream>
 #include <cstring>
+#include <climits>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <git2.h>
-#include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "blob_cache.h"
+#include "fs_blob.h"
+#include "fs_commit.h"
 #include "fs_root.h"
+#include "fs_tip.h"
+#include "fs_tip_tree.h"
+#include "object_store.h"
+#include "tree_index.h"
 #include "git_context.h"
 #include "mount_context.h"
 #include "logger.h"
 
-using FSEntryVector = std::vector<FSEntryPtr>;
-
 struct FileInfo
 {
-	FSEntryVector stack;
+	inline ~FileInfo() { if (backingFd >= 0) close(backingFd); }
+
+	FSEntryPtr entry;
+	std::unique_ptr<FSBlob::Handle> blob;
+
+	// Stored content of the blob and its kernel passthrough registration
+	int backingFd = -1;
+	int backingId = 0;
+	off_t backingSize = 0;
+
+	// Directory listing the readdir offsets of this handle refer to
+	std::shared_ptr<const DirentList> dirents;
+
+	// Whether the file was read in order so far, for the prefetcher
+	pid_t pid = 0;
+	std::atomic<off_t> nextOffset { 0 };
+	std::atomic<bool> sequential { true };
 };
 
 namespace
 {
 
-constexpr fuse_operations _operations = {
+// Nothing reached through a commit can ever change, the kernel may keep it
+// for as long as it likes. The refs are short lived and invalidated explicitly
+// whenever they are rebuilt.
+constexpr double ImmutableTimeout = 365 * 86400.0;
+constexpr double MutableTimeout = 1.0;
+
+inline double timeoutFor(bool immutable)
+{
+	return (immutable ? ImmutableTimeout : MutableTimeout);
+}
+constexpr std::string_view BlobCacheXattr = "user.gitfs.blob_cache";
+
+constexpr fuse_lowlevel_ops _operations = {
+	.init = &GitContext::_fuse_init,
+	.destroy = &GitContext::_fuse_destroy,
+	.lookup = &GitContext::_fuse_lookup,
+	.forget = &GitContext::_fuse_forget,
 	.getattr = &GitContext::_fuse_getattr,
 	.readlink = &GitContext::_fuse_readlink,
 	.open = &GitContext::_fuse_open,
@@ -35,26 +78,31 @@ constexpr fuse_operations _operations = {
 	.opendir = &GitContext::_fuse_open,
 	.readdir = &GitContext::_fuse_readdir,
 	.releasedir = &GitContext::_fuse_release,
-	.init = &GitContext::_fuse_init,
-	.destroy = &GitContext::_fuse_destroy,
+	.getxattr = &GitContext::_fuse_getxattr,
+	.listxattr = &GitContext::_fuse_listxattr,
+	.forget_multi = &GitContext::_fuse_forget_multi,
+	.readdirplus = &GitContext::_fuse_readdirplus,
 };
 
+// Calls func on the context of the request, replies with an error for any
+// non-zero return value. On success func has replied itself.
 template <typename ...ARGS>
-int inContext(int (GitContext::*func)(ARGS ...args), ARGS ...args)
+void inContext(fuse_req_t req, int (GitContext::*func)(fuse_req_t, ARGS ...args), ARGS ...args)
 {
 	int retval;
 
-	GitContext * ctx = GitContext::get();
+	GitContext * ctx = reinterpret_cast<GitContext *>(fuse_req_userdata(req));
 	if (ctx == nullptr)
 	{
 		std::cerr << "FUSE context gone?" << std::endl;
-		return -ENOENT;
+		fuse_reply_err(req, ENOENT);
+		return;
 	}
 
 	retval = -EIO;
 	try
 	{
-		retval = (ctx->*func)(args...);
+		retval = (ctx->*func)(req, args...);
 	}
 	catch (std::exception & e)
 	{
@@ -72,64 +120,112 @@ int inContext(int (GitContext::*func)(ARGS ...args), ARGS ...args)
 	{
 		std::cerr << "Unknown internal error, such fail :(" << std::endl;
 	}
-	return retval;
+
+	if (retval != 0)
+		fuse_reply_err(req, -retval);
 }
 
-int resolvePath(const FSEntryPtr & root, std::string_view path, FSEntryVector & stack)
+// Tree a directory shows, null for pseudo directories
+std::shared_ptr<FSTree> treeOf(const FSEntryPtr & entry)
 {
-	if (!root)
-		return -EINVAL;
-
-	stack.clear();
-	stack.reserve(8);
-	stack.push_back(root);
-
-	int retval = 0;
-
-	while (!path.empty())
-	{
-		std::shared_ptr<FSEntry> nextEntry;
-		retval = stack.back()->getChild(path, nextEntry, false);
-		if (retval)
-			break;
+	if (const FSTipTree * tip = dynamic_cast<const FSTipTree *>(entry.get()))
+		return tip->current();
+	return std::dynamic_pointer_cast<FSTree>(entry);
+}
 
-		stack.push_back(nextEntry);
-	}
+inline GitContext * contextOf(fuse_req_t req)
+{
+	return reinterpret_cast<GitContext *>(fuse_req_userdata(req));
+}
 
-	return retval;
+// Scratch buffer for replies, reused by every request on the same thread
+char * replyBuffer(size_t size)
+{
+	static thread_local std::vector<char> buffer;
+	if (buffer.size() < size)
+		buffer.resize(size);
+	return buffer.data();
 }
 
 } // namespace
 
-GitContext::GitContext(MountContext & mountcontext, const fuse_conn_info *info, const fuse_config *config) : repository(mountcontext.repository)
+GitContext::GitContext(MountContext & mountcontext) : connInfo{}, session(nullptr), repository(mountcontext.repository)
 {
 	mountcontext.repository = nullptr;
 
-	_fuse_conn_info = new fuse_conn_info(*info);
-	_fuse_config = new fuse_config(*config);
-
 	branch.swap(mountcontext.branch);
 	commit.swap(mountcontext.commit);
 	debug = mountcontext.debug;
+	asyncThreads = mountcontext.asyncThreads;
+	prefetchBudget = mountcontext.prefetchBudget;
+	prefetchThreads = mountcontext.prefetchThreads;
+	if (!mountcontext.profilePath.empty())
+		warmup.reset(new WarmupProfile(mountcontext.profilePath, mountcontext.profileSeconds));
 
 	// TODO check capabilities CAP_SETUID, CAP_SETGID
-	uid = config->set_uid ? config->uid : geteuid();
-	gid = config->set_gid ? config->gid : getegid();
+	uid = mountcontext.setUid ? mountcontext.uid : geteuid();
+	gid = mountcontext.setGid ? mountcontext.gid : getegid();
 	umask = mountcontext.readwrite ? 0 : 0222;
-	if (config->set_mode)
-		umask |= (config->umask & ACCESSPERMS);
+	if (mountcontext.setUmask)
+		umask |= (mountcontext.umask & ACCESSPERMS);
 	else
 		umask |= 022;
 
 	atime = 0;
 	time(&atime);
 
-	root = std::make_shared<FSRoot>(repository);
-	root->rebuildRefs();
-	fileInfoKey = 0;
+	BlobCache::instance().setBudget(mountcontext.blobCacheSize);
+
+	ObjectStore & store = ObjectStore::instance();
+	store.setThresholds(mountcontext.passthroughSize, mountcontext.passthroughOpens);
+	store.setLimit(mountcontext.backingSize);
+	if (!mountcontext.backingDir.empty() && !store.setDirectory(mountcontext.backingDir))
+		std::cerr << "gitfs mount: can't use backing directory " << mountcontext.backingDir << ", contents won't be stored" << std::endl;
+	passthrough = store.enabled();
+
+	// Decoded trees are kept with the stored blobs unless told otherwise
+	std::string treeIndex = mountcontext.treeIndexPath;
+	if (treeIndex.empty() && store.enabled())
+		treeIndex = store.directory() + "/trees.idx";
+	TreeIndex::instance().setLimit(mountcontext.treeIndexSize);
+	if (!treeIndex.empty())
+		TreeIndex::instance().open(treeIndex);
+
+	if (mountcontext.objectCacheSize)
+		RepositoryPool::setObjectCacheSize(mountcontext.objectCacheSize);
+	repositories.reset(new RepositoryPool(repository, mountcontext.repositoryHandles));
+
+	if (!commit.empty())
+	{
+		// Everything below a single commit is immutable, there is nothing
+		// to follow and the kernel may cache all of it for good
+		GitObject object = repository.revparse(commit.c_str());
+		GitObject peeled = object.peel(GIT_OBJECT_COMMIT);
+		GitCommit head = repository.resolveCommit(peeled.id());
+		if (!branch.empty())
+			std::cerr << "gitfs mount: branch and commit can't be mounted together" << std::endl;
+		else if (!head)
+			std::cerr << "gitfs mount: can't resolve commit " << commit << std::endl;
+		else
+			nodes.reset(new NodeTable(std::make_shared<FSCommit>(std::move(head))));
+	}
+	else if (!branch.empty())
+	{
+		tip = std::make_shared<FSTip>(repository, branch);
+		if (tip->follow() == 0)
+			nodes.reset(new NodeTable(tip));
+		else
+			std::cerr << "gitfs mount: can't resolve branch " << branch << std::endl;
+	}
+	else
+	{
+		root = std::make_shared<FSRoot>(repository);
+		root->rebuildRefs();
+		nodes.reset(new NodeTable(root));
+	}
 
 	if (debug)
-		std::cout << "Listing files with uid=" << uid << " gid=" << gid << " umask=" << std::oct << std::setw(4) << std::setfill('0') << umask << std::endl;
+		std::cout << "Listing files with uid=" << uid << " gid=" << gid << " umask=" << std::oct << std::setw(4) << std::setfill('0') << umask << std::dec << std::endl;
 
 	// Convenience
 	umask = ~umask;
@@ -137,274 +233,798 @@ GitContext::GitContext(MountContext & mountcontext, const fuse_conn_info *info,
 
 GitContext::~GitContext()
 {
-	delete _fuse_conn_info;
-	delete _fuse_config;
+	// Cached blobs may belong to pooled handles, drop them before the pool goes
+	BlobCache::instance().setBudget(0);
 }
 
-GitContext * GitContext::get()
+const fuse_lowlevel_ops * GitContext::fuseOperations()
 {
-	fuse_context *fuseContext = fuse_get_context();
+	return &_operations;
+}
+
+void GitContext::refreshRefs()
+{
+	FSPseudoDirectory::Changes changes;
+	if (tip)
+		tip->follow(&changes);
+	else if (root)
+		root->rebuildRefs(&changes);
+	lookupCache.purgeStale();
 
-	if (!fuseContext || !fuseContext->private_data)
-		throw -ENOENT;
+	if (!session || (changes.names.empty() && changes.entries.empty()))
+		return;
 
-	return reinterpret_cast<GitContext *>(fuseContext->private_data);
+	if (debug)
+		std::cout << "Refs changed: " << changes.names.size() << " names, " << changes.entries.size() << " entries" << std::endl;
+
+	std::unordered_multimap<const FSEntry *, const std::string *> names;
+	for (const auto & change : changes.names)
+		names.emplace(change.first, &change.second);
+	std::unordered_set<const FSEntry *> entries(changes.entries.cbegin(), changes.entries.cend());
+
+	// Collect first, the kernel may answer notifications with forgets that
+	// need the node table
+	std::vector<std::pair<fuse_ino_t, const std::string *>> invalidEntries;
+	std::vector<fuse_ino_t> invalidInodes;
+	nodes->forEach([&] (NodeTable::NodeId id, const NodeTable::Node & node)
+	{
+		if (entries.count(node.entry.get()))
+			invalidInodes.push_back(id);
+
+		auto range = names.equal_range(node.entry.get());
+		for (auto iter = range.first; iter != range.second; ++iter)
+			invalidEntries.emplace_back(id, iter->second);
+	});
+
+	for (const auto & entry : invalidEntries)
+		fuse_lowlevel_notify_inval_entry(session, entry.first, entry.second->data(), entry.second->size());
+	for (fuse_ino_t ino : invalidInodes)
+		fuse_lowlevel_notify_inval_inode(session, ino, 0, 0);
 }
 
-const fuse_operations * GitContext::fuseOperations()
+bool GitContext::isCachedLookup(fuse_ino_t parent, const char *name) const
 {
-	return &_operations;
+	FSEntryPtr target;
+	return lookupCache.find(nodes->find(parent)->entry, name, target);
 }
 
-void * GitContext::_fuse_init(fuse_conn_info *conn, fuse_config *cfg)
+bool GitContext::isResident(const fuse_file_info *fi) const
 {
-	fuse_context *fuseContext = fuse_get_context();
-	MountContext *mountContext = reinterpret_cast<MountContext *>(fuseContext->private_data);
+	const FileInfo * info = fileInfo.find(fi->fh);
+	if (!info)
+		return true;
 
-	// Don't need path information for opened files, we'll have a SHA1
-	cfg->nullpath_ok = 1;
+	return (info->blob ? info->blob->data() != nullptr : info->backingFd >= 0);
+}
 
-	// Disable caching if we're mounting the tip of a specific branch so underlying commits can happen
-	cfg->kernel_cache = mountContext->branch.empty() ? 0 : 1;
+void GitContext::recordTouched(const FSEntryPtr & parent, std::string_view name, const FSEntryPtr & target)
+{
+	std::shared_ptr<FSTree> parentTree = treeOf(parent);
+	const git_oid * parentId = (parentTree && parentTree->node() ? &parentTree->node()->id() : nullptr);
+
+	// Files are recorded when they are opened, however their node was handed out
+	std::shared_ptr<FSTree> tree = treeOf(target);
+	if (tree && tree->node())
+		warmup->touched(parentId, name, tree->node()->id());
+}
+
+int GitContext::lookupChild(const FSEntryPtr & parent, std::string_view name, FSEntryPtr & target)
+{
+	if (lookupCache.find(parent, name, target))
+		return (target ? 0 : -ENOENT);
+
+	uint64_t generation = parent->generation();
 
-	// Honour inodes on 64 bit systems, the first 8 bytes (16 hex) of SHA1 hashes are unique enough
-	if (sizeof(stat::st_ino) == 8)
-		cfg->use_ino = 1;
+	std::string_view remainder = name;
+	int retval = parent->getChild(remainder, target, false);
+	if (retval == -ENOENT && generation != 0 && parent->isMissStable(name))
+		lookupCache.insert(parent, name, FSEntryPtr(), generation);
+	if (retval)
+		return retval;
 
-	// Always attempt to prefill the inode cache from a directory listing
-	cfg->readdir_ino = 1;
+	// Names never contain a separator, but don't trust getChild blindly
+	if (!remainder.empty())
+		return -ENOENT;
 
-	return new GitContext(*mountContext, conn, cfg);
+	lookupCache.insert(parent, name, target, generation);
+	return 0;
 }
 
-void GitContext::_fuse_destroy(void *private_data)
+void GitContext::fillAttr(const FSEntry & entry, struct stat *st) const
 {
-	if (private_data)
+	*st = {};
+	st->st_uid = uid;
+	st->st_gid = gid;
+	st->st_nlink = 1;
+	st->st_atime = atime;
+	st->st_ctime = atime;
+	st->st_mtime = atime;
+	entry.fillStat(st);
+	st->st_mode &= umask;
+}
+
+void GitContext::_fuse_init(void *userdata, fuse_conn_info *conn)
+{
+	GitContext *context = reinterpret_cast<GitContext *>(userdata);
+	if (!context || !conn)
+		return;
+
+#ifdef FUSE_CAP_PASSTHROUGH
+	// Reads of stored blobs go straight to the backing files
+	if (context->passthrough && (conn->capable & FUSE_CAP_PASSTHROUGH))
 	{
-		GitContext *gitContext = reinterpret_cast<GitContext*>(private_data);
-		delete gitContext;
+		conn->want |= FUSE_CAP_PASSTHROUGH;
+		conn->max_backing_stack_depth = 1;
+	}
+	else
+	{
+		context->passthrough = false;
+	}
+#else
+	context->passthrough = false;
+#endif
+
+	// Read replies are spliced or written from cache memory, and as large as
+	// libfuse allows; max_pages follows from max_write
+	conn->want |= (conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE));
+	conn->max_write = UINT_MAX;
+	conn->max_readahead = UINT_MAX;
+
+	// Started here for the same reason as the ref watcher below
+	if (context->asyncThreads)
+		context->executor.reset(new Executor(context->asyncThreads));
+	if (context->prefetchBudget && context->prefetchThreads)
+		context->prefetcher.reset(new Prefetcher(context->prefetchThreads, context->prefetchBudget));
+	if (context->warmup)
+	{
+		std::shared_ptr<FSTree> root = treeOf(context->nodes->find(FUSE_ROOT_ID)->entry);
+		context->warmup->start(context->repository, root && root->node() ? &root->node()->id() : nullptr);
+	}
+
+	// A mounted commit never changes, attributes needn't be compared
+	if (!context->commit.empty())
+		conn->want &= ~FUSE_CAP_AUTO_INVAL_DATA;
+
+	context->connInfo = *conn;
+
+	// Nothing to watch below a single commit
+	if (!context->commit.empty())
+		return;
+
+	// Started here rather than with the context, which exists before the
+	// mount daemonizes and would lose the thread to the fork
+	context->refWatcher.reset(new RefWatcher([context] { context->refreshRefs(); }));
+	if (!context->refWatcher->start(context->repository.path(), context->repository.commonDir()))
+	{
+		std::cerr << "gitfs mount: can't watch the refs, they won't be updated" << std::endl;
+		context->refWatcher.reset();
+	}
+	else
+	{
+		// Catch up with anything that changed between mounting and watching,
+		// the kernel has nothing cached yet
+		if (context->tip)
+			context->tip->follow();
+		else
+			context->root->rebuildRefs();
+		context->lookupCache.purgeStale();
 	}
 }
 
-int GitContext::_fuse_getattr(const char *path, struct stat *st, struct fuse_file_info *fi)
+void GitContext::_fuse_destroy(void *userdata)
 {
-	if ((!path && !fi) || !st)
-		return -EINVAL;
+	// The context is owned by the mount, it outlives the session; the
+	// watcher must not notify a session that is going away
+	GitContext *context = reinterpret_cast<GitContext *>(userdata);
+	if (context)
+	{
+		context->refWatcher.reset();
+		context->executor.reset();
+		context->prefetcher.reset();
+		if (context->warmup)
+			context->warmup->stop();
+		ObjectStore::instance().stop();
+
+		// Nothing decodes trees anymore, what was decoded is kept for the next mount
+		if (TreeIndex::instance().enabled() && !TreeIndex::instance().save())
+			std::cerr << "gitfs mount: can't save the tree index" << std::endl;
+	}
+}
 
-	return inContext(&GitContext::fuse_getattr, path ? std::string_view(path) : std::string_view(), st, fi);
+void GitContext::_fuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	if (!name)
+	{
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+
+	// Cached names are answered right away, anything else may decode a tree
+	GitContext * context = contextOf(req);
+	if (context && context->executor && !context->isCachedLookup(parent, name))
+	{
+		std::string copy(name);
+		context->executor->submit([req, parent, copy]
+		{
+			inContext(req, &GitContext::fuse_lookup, parent, copy.c_str());
+		});
+		return;
+	}
+
+	inContext(req, &GitContext::fuse_lookup, parent, name);
 }
 
-int GitContext::fuse_getattr(std::string_view path, struct stat *st, struct fuse_file_info *fi)
+int GitContext::fuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
 	int retval = -ENOENT;
 
 	Logger log(retval, debug);
-	log << "getattr:";
-	if (fi)
-		log << " handle=" << fi->fh;
-	else
-		log << " path=" << path;
-	log << Logger::retval;
+	log << "lookup: parent=" << parent << " name=" << name << Logger::retval;
 
-	if (fi)
+	NodeTable::Node * node = nodes->find(parent);
+
+	FSEntryPtr target;
+	retval = lookupChild(node->entry, name, target);
+	if (retval == -ENOENT)
 	{
+		// Let the kernel remember misses too, a miss inside a tree is permanent.
+		// Commit ids may turn up any time, they are asked for again.
+		fuse_entry_param entry = {};
+		if (node->entry->isMissStable(name))
+			entry.entry_timeout = timeoutFor(node->entry->isImmutable());
+		fuse_reply_entry(req, &entry);
+		return 0;
 	}
-	else if (!path.empty() && path.front() == '/')
+
+	if (retval == 0)
 	{
-		FSEntryVector entries;
-		retval = resolvePath(root, path.substr(1), entries);
-		if (retval == 0)
-		{
-			st->st_uid = uid;
-			st->st_gid = gid;
-			st->st_nlink = 1;
-			st->st_atime = atime;
-			st->st_ctime = atime;
-			st->st_mtime = atime;
-			entries.back()->fillStat(st);
-			st->st_mode &= umask;
-		}
+		fuse_entry_param entry = {};
+		fillAttr(*target, &entry.attr);
+		entry.attr_timeout = timeoutFor(target->isImmutable());
+		entry.entry_timeout = entry.attr_timeout;
+		entry.ino = nodes->acquire(parent, name, target);
+
+		// The kernel only holds on to the node if the reply arrived
+		if (fuse_reply_entry(req, &entry) != 0)
+			nodes->forget(entry.ino, 1);
+
+		log << " ino=" << entry.ino;
+
+		if (warmup && warmup->recording())
+			recordTouched(node->entry, name, target);
 	}
 
 	return retval;
 }
 
-int GitContext::_fuse_readlink(const char *path, char *buf, size_t bufsize)
+void GitContext::_fuse_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+	fuse_forget_data forget { ino, nlookup };
+	inContext(req, &GitContext::fuse_forget, size_t(1), &forget);
+}
+
+void GitContext::_fuse_forget_multi(fuse_req_t req, size_t count, fuse_forget_data *forgets)
+{
+	inContext(req, &GitContext::fuse_forget, count, forgets);
+}
+
+int GitContext::fuse_forget(fuse_req_t req, size_t count, fuse_forget_data *forgets)
 {
-	if (!path || !buf || !bufsize)
-		return -EINVAL;
+	for (size_t i = 0; i < count; ++i)
+		nodes->forget(forgets[i].ino, forgets[i].nlookup);
 
-	return inContext(&GitContext::fuse_readlink, std::string_view(path), buf, bufsize);
+	fuse_reply_none(req);
+	return 0;
 }
 
-int GitContext::fuse_readlink(std::string_view path, char *buf, size_t bufsize)
+void GitContext::_fuse_getattr(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi)
+{
+	inContext(req, &GitContext::fuse_getattr, ino, fi);
+}
+
+int GitContext::fuse_getattr(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi)
 {
 	int retval = -ENOENT;
 
 	Logger log(retval, debug);
-	log << "readlink: path=" << path << " bufsize=" << bufsize << Logger::retval;
+	log << "getattr: ino=" << ino;
+	if (fi)
+		log << " handle=" << fi->fh;
+	log << Logger::retval;
+
+	// Opened files answer from their handle, which pins the entry they opened
+	FileInfo * info = (fi ? fileInfo.find(fi->fh) : nullptr);
+	const FSEntryPtr & entry = (info ? info->entry : nodes->find(ino)->entry);
+
+	struct stat st;
+	fillAttr(*entry, &st);
+	retval = 0;
 
-	if (!path.empty() && path.front() == '/')
+	fuse_reply_attr(req, &st, timeoutFor(entry->isImmutable()));
+	return retval;
+}
+
+void GitContext::_fuse_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+	inContext(req, &GitContext::fuse_readlink, ino);
+}
+
+int GitContext::fuse_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+	int retval = -ENOENT;
+
+	Logger log(retval, debug);
+	log << "readlink: ino=" << ino << Logger::retval;
+
+	char buffer[PATH_MAX + 1];
+	retval = nodes->find(ino)->entry->readLink(buffer, sizeof(buffer));
+	if (retval == 0)
 	{
-		FSEntryVector entries;
-		retval = resolvePath(root, path.substr(1), entries);
-		if (retval == 0)
-			retval = entries.back()->readLink(buf, bufsize);
+		buffer[PATH_MAX] = 0;
+		fuse_reply_readlink(req, buffer);
 	}
 
 	return retval;
 }
 
-int GitContext::_fuse_open(const char *path, struct fuse_file_info *fi)
+void GitContext::_fuse_open(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi)
+{
+	if (!fi)
+	{
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+
+	// Opening a blob inflates it or stores it in the backing directory
+	GitContext * context = contextOf(req);
+	if (context && context->executor && context->nodes->find(ino)->entry->cast<FSBlob>())
+	{
+		fuse_file_info copy = *fi;
+		context->executor->submit([req, ino, copy] () mutable
+		{
+			inContext(req, &GitContext::fuse_open, ino, &copy);
+		});
+		return;
+	}
+
+	inContext(req, &GitContext::fuse_open, ino, fi);
+}
+
+void GitContext::_fuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fi)
 {
-	if (!path || !fi)
-		return -EINVAL;
+	if (!fi)
+	{
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+
+	// Only streamed blobs inflate while reading
+	GitContext * context = contextOf(req);
+	if (context && context->executor && !context->isResident(fi))
+	{
+		fuse_file_info copy = *fi;
+		context->executor->submit([req, size, offset, copy] () mutable
+		{
+			inContext(req, &GitContext::fuse_read, size, offset, &copy);
+		});
+		return;
+	}
 
-	return inContext(&GitContext::fuse_open, std::string_view(path), fi);
+	inContext(req, &GitContext::fuse_read, size, offset, fi);
 }
 
-int GitContext::_fuse_read(const char *path, char *buffer, size_t bufsize, off_t offset, struct fuse_file_info *fi)
+void GitContext::_fuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fi)
 {
-	if (!buffer || !bufsize || !fi)
-		return -EINVAL;
+	if (!fi)
+	{
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+
+	// The first batch lists the directory, which decodes and sizes a tree
+	GitContext * context = contextOf(req);
+	if (context && context->executor && offset == 0)
+	{
+		fuse_file_info copy = *fi;
+		context->executor->submit([req, ino, size, offset, copy] () mutable
+		{
+			inContext(req, &GitContext::fuse_readdir, ino, size, offset, &copy, false);
+		});
+		return;
+	}
 
-	return inContext(&GitContext::fuse_read, buffer, bufsize, offset, fi);
+	inContext(req, &GitContext::fuse_readdir, ino, size, offset, fi, false);
 }
 
-int GitContext::_fuse_readdir(const char *path, void *fusebuf, fuse_fill_dir_t fillfunc, off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+void GitContext::_fuse_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fi)
 {
-	if (!fusebuf || !fillfunc || !fi)
-		return -EINVAL;
+	if (!fi)
+	{
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
 
-	return inContext(&GitContext::fuse_readdir, fusebuf, fillfunc, offset, fi, flags);
+	// The first batch lists the directory, which decodes and sizes a tree
+	GitContext * context = contextOf(req);
+	if (context && context->executor && offset == 0)
+	{
+		fuse_file_info copy = *fi;
+		context->executor->submit([req, ino, size, offset, copy] () mutable
+		{
+			inContext(req, &GitContext::fuse_readdir, ino, size, offset, &copy, true);
+		});
+		return;
+	}
+
+	inContext(req, &GitContext::fuse_readdir, ino, size, offset, fi, true);
 }
 
-int GitContext::_fuse_release(const char *path, struct fuse_file_info *fi)
+void GitContext::_fuse_release(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi)
 {
 	if (!fi)
-		return -EINVAL;
+	{
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
 
-	return inContext(&GitContext::fuse_release, fi);
+	inContext(req, &GitContext::fuse_release, fi);
 }
 
-int GitContext::fuse_open(std::string_view path, struct fuse_file_info *fi)
+int GitContext::fuse_open(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi)
 {
 	int retval = -ENOENT;
 
 	Logger log(retval, debug);
-	log << "open: path=" << path << Logger::retval;
+	log << "open: ino=" << ino << Logger::retval;
+
+	std::unique_ptr<FileInfo> info(new FileInfo);
+	info->entry = nodes->find(ino)->entry;
+
+	const FSBlob * blob = info->entry->cast<FSBlob>();
+	info->pid = fuse_req_ctx(req)->pid;
 
-	if (!path.empty() && path.front() == '/')
+	// Started before inflating, so the next files are on their way already
+	std::shared_ptr<FSTree> parent = (blob && prefetcher ? treeOf(nodes->find(nodes->find(ino)->parent)->entry) : nullptr);
+	if (parent)
+		prefetcher->opened(info->pid, parent->repository(), parent->node(), blob->id());
+	if (blob && warmup && warmup->recording())
 	{
-		FSEntryVector entries;
-		retval = resolvePath(root, path.substr(1), entries);
-		if (retval == 0)
-		{
-			std::shared_ptr<FileInfo> info = std::make_shared<FileInfo>();
-			info->stack.swap(entries);
+		NodeTable::Node * node = nodes->find(ino);
+		std::shared_ptr<FSTree> tree = treeOf(nodes->find(node->parent)->entry);
+		if (tree && tree->node())
+			warmup->opened(tree->node()->id(), node->name, blob->id());
+	}
 
-			std::lock_guard<std::mutex> guard(fileInfoLock);
-			++fileInfoKey;
-			fileInfo.insert(std::make_pair(fileInfoKey, info));
-			fi->fh = fileInfoKey;
-		}
+	if (blob && ObjectStore::instance().enabled())
+		openBacking(req, *blob, *info, fi);
+	if (blob && info->backingFd < 0)
+		info->blob = blob->open();
+
+	// Page cache and readdir cache survive reopening for immutable content
+	fi->keep_cache = info->entry->isImmutable();
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 5)
+	fi->cache_readdir = info->entry->isImmutable();
+#endif
+	fi->fh = fileInfo.insert(std::move(info));
+	retval = 0;
+
+	// An interrupted open is never released by the kernel
+	if (fuse_reply_open(req, fi) != 0)
+	{
+		std::unique_ptr<FileInfo> removed = fileInfo.remove(fi->fh);
+		if (removed)
+			closeBacking(req, *removed);
 	}
 
 	log << " handle=" << fi->fh;
 	return retval;
 }
 
-int GitContext::fuse_read(char *buffer, size_t bufsize, off_t offset, struct fuse_file_info *fi)
+int GitContext::fuse_read(fuse_req_t req, size_t size, off_t offset, fuse_file_info *fi)
 {
 	int retval = -EINVAL;
 
 	Logger log(retval, debug);
-	log << "read: handle=" << fi->fh << " bufsize=" << bufsize << " offset=" << offset << Logger::retval;
+	log << "read: handle=" << fi->fh << " size=" << size << " offset=" << offset << Logger::retval;
 
-	std::shared_ptr<FileInfo> info;
+	// Handles stay valid until released, the kernel won't release one in use
+	FileInfo * info = fileInfo.find(fi->fh);
 
-	std::unique_lock<std::mutex> guard(fileInfoLock);
-	auto iter = fileInfo.find(fi->fh);
-	if (iter != fileInfo.end())
-		info = iter->second;
-	guard.unlock();
+	if (!info)
+		return retval;
 
-	if (info)
+	// Resident blobs and stored files are handed to libfuse as they are: memory
+	// is written to the kernel straight from the cache, files are spliced
+	fuse_bufvec data = FUSE_BUFVEC_INIT(0);
+	if (info->blob && info->blob->data())
+	{
+		size_t available = (size_t(offset) < info->blob->size() ? info->blob->size() - offset : 0);
+		data.buf[0].size = std::min(size, available);
+		data.buf[0].mem = const_cast<char *>(info->blob->data() + (available ? offset : 0));
+	}
+	else if (!info->blob && info->backingFd >= 0)
+	{
+		data.buf[0].size = (offset < info->backingSize ? std::min<off_t>(size, info->backingSize - offset) : 0);
+		data.buf[0].flags = fuse_buf_flags(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+		data.buf[0].fd = info->backingFd;
+		data.buf[0].pos = offset;
+	}
+	else
 	{
-		retval = info->stack.back()->read(buffer, bufsize, offset);
+		char * buffer = replyBuffer(size);
+		if (info->blob)
+			retval = info->blob->read(buffer, size, offset);
+		else
+			retval = info->entry->read(buffer, size, offset);
+
+		if (retval < 0)
+			return retval;
+
+		data.buf[0].size = retval;
+		data.buf[0].mem = buffer;
 	}
 
+	if (info->nextOffset.exchange(offset + data.buf[0].size, std::memory_order_relaxed) != offset)
+		info->sequential.store(false, std::memory_order_relaxed);
+
+	retval = 0;
+	fuse_reply_data(req, &data, FUSE_BUF_SPLICE_MOVE);
 	return retval;
 }
 
-int GitContext::fuse_readdir(void *fusebuf, fuse_fill_dir_t fillfunc, off_t offset, struct fuse_file_info *fi, fuse_readdir_flags flags)
+int GitContext::fuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fi, bool plus)
 {
 	int retval = -EINVAL;
 
 	Logger log(retval, debug);
-	log << "readdir: handle=" << fi->fh << " offset=" << offset << Logger::retval;
+	log << (plus ? "readdirplus" : "readdir") << ": handle=" << fi->fh << " size=" << size << " offset=" << offset << Logger::retval;
 
-	std::shared_ptr<FileInfo> info;
+	FileInfo * info = fileInfo.find(fi->fh);
+	if (!info)
+		return retval;
 
-	std::unique_lock<std::mutex> guard(fileInfoLock);
-	auto iter = fileInfo.find(fi->fh);
-	if (iter != fileInfo.end())
-		info = iter->second;
-	guard.unlock();
+	// Trees hand out their shared cached listing, mutable directories a
+	// snapshot that stays stable until the handle rewinds
+	if (!info->dirents || offset == 0)
+		info->dirents = info->entry->listChildren();
 
-	if (info)
+	std::shared_ptr<FSTree> tree = (offset == 0 && prefetcher ? treeOf(info->entry) : nullptr);
+	if (tree)
+		prefetcher->listed(fuse_req_ctx(req)->pid, tree->repository(), tree->node());
+
+	const DirentList * list = info->dirents.get();
+	if (!list)
 	{
-		retval = 0;
+		retval = -ENOTDIR;
+		return retval;
+	}
 
-		struct stat st = {};
-		st.st_uid = uid;
-		st.st_gid = gid;
-		st.st_nlink = 1;
-		st.st_atime = atime;
-		st.st_ctime = atime;
-		st.st_mtime = atime;
-
-		off_t index = offset;
-		if (index == 0)
-		{
-			info->stack.back()->fillStat(&st);
-			st.st_mode &= umask;
-			fillfunc(fusebuf, ".", &st, 1, fuse_fill_dir_flags(FUSE_FILL_DIR_PLUS));
-			index = 1;
-		}
+	char * buffer = replyBuffer(size);
+	size_t used = 0;
 
+	struct stat st = {};
+	st.st_uid = uid;
+	st.st_gid = gid;
+	st.st_nlink = 1;
+	st.st_atime = atime;
+	st.st_ctime = atime;
+	st.st_mtime = atime;
+
+	fuse_entry_param entry = {};
+
+	// "." and ".." don't count as lookups, they are passed without a node
+	off_t index = offset;
+	while (index < 2)
+	{
+		const NodeTable::Node * node = nodes->find(ino);
 		if (index == 1)
+			node = nodes->find(node->parent);
+
+		fillAttr(*node->entry, &entry.attr);
+		entry.attr_timeout = timeoutFor(node->entry->isImmutable());
+		entry.entry_timeout = entry.attr_timeout;
+
+		const char * name = (index == 0 ? "." : "..");
+		size_t length = (plus ? fuse_add_direntry_plus(req, buffer + used, size - used, name, &entry, index + 1)
+				: fuse_add_direntry(req, buffer + used, size - used, name, &entry.attr, index + 1));
+		if (length > size - used)
+			break;
+
+		used += length;
+		++index;
+	}
+
+	size_t id = (index >= 2 ? size_t(index - 2) : list->size());
+
+	if (!plus && id < list->size())
+	{
+		// Plain listings never change, copy as many whole entries as fit
+		const DirentList::Packed & packed = list->packed();
+		size_t start = (id == 0 ? 0 : packed.ends[id - 1]);
+		auto last = std::upper_bound(packed.ends.begin() + id, packed.ends.end(), start + (size - used));
+		size_t end = (last == packed.ends.begin() + id ? start : *(last - 1));
+
+		std::memcpy(buffer + used, packed.data.data() + start, end - start);
+		used += end - start;
+	}
+
+	const FSEntryPtr & parent = nodes->find(ino)->entry;
+	bool mutableParent = (parent->generation() != 0);
+
+	for ( ; plus && id < list->size(); ++id)
+	{
+		const struct stat & cached = list->stat(id);
+		st.st_ino = cached.st_ino;
+		st.st_mode = cached.st_mode & umask;
+		st.st_nlink = cached.st_nlink;
+		st.st_size = cached.st_size;
+
+		entry.ino = 0;
+		entry.attr = st;
+
+		const char * name = list->name(id);
+		size_t length = fuse_add_direntry_plus(req, nullptr, 0, name, &entry, off_t(id) + DirentList::FirstOffset);
+		if (length > size - used)
+			break;
+
+		// Subtrees would have to be decoded just to hand out a node, those are
+		// left to a regular lookup unless they were resolved before
+		FSEntryPtr target;
+		if (mutableParent || !S_ISDIR(cached.st_mode) || lookupCache.find(parent, name, target))
 		{
-			fillfunc(fusebuf, "..", nullptr, 2, fuse_fill_dir_flags(0));
-			index = 2;
+			if (target || lookupChild(parent, name, target) == 0)
+				entry.ino = nodes->acquire(ino, name, target);
 		}
 
-		retval = info->stack.back()->enumerateChildren([&](const char *name, off_t idx, struct stat *st) -> int
-		{
-			st->st_mode &= umask;
-			return fillfunc(fusebuf, name, st, idx + 2, fuse_fill_dir_flags(FUSE_FILL_DIR_PLUS));
-		}, index - 2, &st);
+		entry.attr_timeout = timeoutFor(target ? target->isImmutable() : !mutableParent);
+		entry.entry_timeout = entry.attr_timeout;
+
+		fuse_add_direntry_plus(req, buffer + used, size - used, name, &entry, off_t(id) + DirentList::FirstOffset);
+		used += length;
 	}
 
+	retval = 0;
+	fuse_reply_buf(req, buffer, used);
 	return retval;
 }
 
-int GitContext::fuse_release(struct fuse_file_info *fi)
+int GitContext::fuse_release(fuse_req_t req, fuse_file_info *fi)
 {
 	int retval = -EINVAL;
 
 	Logger log(retval, debug);
-	log << "releasedir: handle=" << fi->fh << Logger::retval;
+	log << "release: handle=" << fi->fh << Logger::retval;
+
+	std::unique_ptr<FileInfo> info = fileInfo.remove(fi->fh);
+	if (info && prefetcher && info->blob && info->sequential)
+	{
+		struct stat st = {};
+		info->entry->fillStat(&st);
+		if (info->nextOffset >= st.st_size)
+			prefetcher->readWhole(info->pid);
+	}
+
+	if (info)
+	{
+		closeBacking(req, *info);
+		retval = 0;
+		fuse_reply_err(req, 0);
+	}
+
+	return retval;
+}
+
+void GitContext::openBacking(fuse_req_t req, const FSBlob & blob, FileInfo & info, fuse_file_info *fi)
+{
+	// Stored content is served from its file even without passthrough, a
+	// restarted mount doesn't inflate it again
+	info.backingFd = blob.openBacking();
+	if (info.backingFd < 0)
+		return;
+
+	struct stat st;
+	info.backingSize = (fstat(info.backingFd, &st) == 0 ? st.st_size : 0);
+
+#ifdef FUSE_CAP_PASSTHROUGH
+	if (!passthrough)
+		return;
+
+	// Without a registration reads still come here, served from the file
+	int backingId = fuse_passthrough_open(req, info.backingFd);
+	if (backingId > 0)
+	{
+		info.backingId = backingId;
+		fi->backing_id = backingId;
+	}
+#endif
+}
+
+void GitContext::closeBacking(fuse_req_t req, FileInfo & info)
+{
+#ifdef FUSE_CAP_PASSTHROUGH
+	if (info.backingId > 0)
+		fuse_passthrough_close(req, info.backingId);
+	info.backingId = 0;
+#endif
+}
+
+void GitContext::_fuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size)
+{
+	if (!name)
+	{
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+
+	inContext(req, &GitContext::fuse_getxattr, ino, std::string_view(name), size);
+}
+
+int GitContext::fuse_getxattr(fuse_req_t req, fuse_ino_t ino, std::string_view name, size_t size)
+{
+	int retval = -ENODATA;
+
+	Logger log(retval, debug);
+	log << "getxattr: ino=" << ino << " name=" << name << Logger::retval;
+
+	// Cache statistics are published on the mount root only
+	if (ino != FUSE_ROOT_ID || name != BlobCacheXattr)
+		return retval;
 
-	std::shared_ptr<FileInfo> info;
+	BlobCache::Stats stats = BlobCache::instance().stats();
 
-	std::lock_guard<std::mutex> guard(fileInfoLock);
-	auto iter = fileInfo.find(fi->fh);
-	if (iter != fileInfo.end())
+	std::ostringstream text;
+	text << "hits=" << stats.hits
+		<< " misses=" << stats.misses
+		<< " evictions=" << stats.evictions
+		<< " entries=" << stats.entries
+		<< " pinned=" << stats.pinned
+		<< " bytes=" << stats.bytes
+		<< " budget=" << stats.budget;
+
+	std::string result = text.str();
+	if (size == 0)
+	{
+		retval = 0;
+		fuse_reply_xattr(req, result.size());
+	}
+	else if (size < result.size())
+	{
+		retval = -ERANGE;
+	}
+	else
 	{
-		fileInfo.erase(iter);
 		retval = 0;
+		fuse_reply_buf(req, result.data(), result.size());
 	}
 
 	return retval;
 }
+
+void GitContext::_fuse_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+	inContext(req, &GitContext::fuse_listxattr, ino, size);
+}
+
+int GitContext::fuse_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+	int retval = 0;
+
+	Logger log(retval, debug);
+	log << "listxattr: ino=" << ino << Logger::retval;
+
+	std::string list;
+	if (ino == FUSE_ROOT_ID)
+	{
+		list.assign(BlobCacheXattr);
+		list.push_back('\0');
+	}
+
+	if (size == 0)
+		fuse_reply_xattr(req, list.size());
+	else if (size < list.size())
+		retval = -ERANGE;
+	else
+		fuse_reply_buf(req, list.data(), list.size());
+
+	return retval;
+}
@@ -3,67 +3,107 @@
 
 #include <string>
 #include <sys/types.h>
-#include <map>
 #include <memory>
-#include <mutex>
+#include <fuse_lowlevel.h>
 #include "git_wrappers.h"
+#include "executor.h"
+#include "handle_table.h"
+#include "lookup_cache.h"
+#include "node_table.h"
+#include "prefetcher.h"
+#include "ref_watcher.h"
+#include "repository_pool.h"
+#include "warmup_profile.h"
 
-struct fuse_operations;
-struct fuse_conn_info;
-struct fuse_config;
 struct MountContext;
+class FSBlob;
 class FSRoot;
+class FSTip;
 struct FileInfo;
 
 struct GitContext
 {
-	GitContext(MountContext & mountcontext, const fuse_conn_info *info, const fuse_config *config);
+	GitContext(MountContext & mountcontext);
 	~GitContext();
 
-	static GitContext * get();
-	static const fuse_operations* fuseOperations();
+	static const fuse_lowlevel_ops* fuseOperations();
 
-	fuse_conn_info *_fuse_conn_info;
-	fuse_config *_fuse_config;
+	fuse_conn_info connInfo;
+	fuse_session *session;
 
 	GitRepository repository;
+	std::unique_ptr<RepositoryPool> repositories;
 	std::string branch;
 	std::string commit;
 	bool debug;
+	bool passthrough;
 	uid_t uid;
 	gid_t gid;
 	mode_t umask;
 	time_t atime;
 
+	// The refs, or with a branch the tip that is followed instead
 	std::shared_ptr<FSRoot> root;
+	std::shared_ptr<FSTip> tip;
+	LookupCache lookupCache;
+	std::unique_ptr<NodeTable> nodes;
 
-	using FileInfoKey = decltype(fuse_file_info::fh);
-	using FileInfoMap = std::map<FileInfoKey, std::shared_ptr<FileInfo>>;
-	FileInfoMap fileInfo;
-	FileInfoKey fileInfoKey;
-	std::mutex fileInfoLock;
-
-	static void* _fuse_init(fuse_conn_info *conn, fuse_config *cfg);
-	static void _fuse_destroy(void *private_data);
-
-	static int _fuse_getattr(const char *path, struct stat *st, fuse_file_info *fi);
-	int fuse_getattr(std::string_view path, struct stat *st, fuse_file_info *fi);
-	static int _fuse_readlink(const char *path, char *buf, size_t bufsize);
-	int fuse_readlink(std::string_view path, char *buf, size_t bufsize);
-
-	static int _fuse_open(const char *path, struct fuse_file_info *fi);
-	static int _fuse_read(const char *path, char *buffer, size_t bufsize, off_t offset, struct fuse_file_info *fi);
-	static int _fuse_readdir(const char *path, void *fusebuf, fuse_fill_dir_t fillfunc, off_t offset, fuse_file_info *fi, fuse_readdir_flags flags);
-	static int _fuse_release(const char *path, struct fuse_file_info *fi);
-	int fuse_open(std::string_view path, struct fuse_file_info *fi);
-	int fuse_read(char *buffer, size_t bufsize, off_t offset, struct fuse_file_info *fi);
-	int fuse_readdir(void *fusebuf, fuse_fill_dir_t fillfunc, off_t offset, struct fuse_file_info *fi, fuse_readdir_flags flags);
-	int fuse_release(struct fuse_file_info *fi);
-};
+	HandleTable<FileInfo> fileInfo;
+	std::unique_ptr<RefWatcher> refWatcher;
+
+	// Runs requests that may inflate or decode objects, if any threads are configured
+	size_t asyncThreads;
+	std::unique_ptr<Executor> executor;
+
+	// Warms up what walking processes are about to touch, if enabled
+	size_t prefetchBudget;
+	size_t prefetchThreads;
+	std::unique_ptr<Prefetcher> prefetcher;
+
+	// Replays and records what the first seconds of a mount touch, if a profile is set
+	std::unique_ptr<WarmupProfile> warmup;
+
+	// Rebuilds the refs or moves the tip, and drops what the kernel cached
+	// of what changed
+	void refreshRefs();
+
+	static void _fuse_init(void *userdata, fuse_conn_info *conn);
+	static void _fuse_destroy(void *userdata);
 
-#define IN_CONTEXT(x,func) \
-	GitContext * x = GitContext::get(); \
-	if (x == nullptr) return -ENOENT \
-	return x->func
+	static void _fuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name);
+	int fuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name);
+	static void _fuse_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup);
+	static void _fuse_forget_multi(fuse_req_t req, size_t count, fuse_forget_data *forgets);
+	int fuse_forget(fuse_req_t req, size_t count, fuse_forget_data *forgets);
+
+	static void _fuse_getattr(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi);
+	int fuse_getattr(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi);
+	static void _fuse_readlink(fuse_req_t req, fuse_ino_t ino);
+	int fuse_readlink(fuse_req_t req, fuse_ino_t ino);
+
+	static void _fuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size);
+	int fuse_getxattr(fuse_req_t req, fuse_ino_t ino, std::string_view name, size_t size);
+	static void _fuse_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size);
+	int fuse_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size);
+
+	static void _fuse_open(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi);
+	static void _fuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fi);
+	static void _fuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fi);
+	static void _fuse_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fi);
+	static void _fuse_release(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi);
+	int fuse_open(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi);
+	int fuse_read(fuse_req_t req, size_t size, off_t offset, fuse_file_info *fi);
+	int fuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info *fi, bool plus);
+	int fuse_release(fuse_req_t req, fuse_file_info *fi);
+
+private:
+	bool isCachedLookup(fuse_ino_t parent, const char *name) const;
+	bool isResident(const fuse_file_info *fi) const;
+	void recordTouched(const FSEntryPtr & parent, std::string_view name, const FSEntryPtr & target);
+	int lookupChild(const FSEntryPtr & parent, std::string_view name, FSEntryPtr & target);
+	void fillAttr(const FSEntry & entry, struct stat *st) const;
+	void openBacking(fuse_req_t req, const FSBlob & blob, FileInfo & info, fuse_file_info *fi);
+	void closeBacking(fuse_req_t req, FileInfo & info);
+};
 
 #endif // GIT_CONTEXT_H_
@@ -73,6 +73,14 @@ GitTree GitRepositoryView::resolveTree(const git_oid * oid) const
 	return tree;
 }
 
+GitObject GitRepositoryView::revparse(const char *spec) const
+{
+	GitObject object;
+	if (data && spec)
+		git_revparse_single(object.fill(), data, spec);
+	return object;
+}
+
 int GitRepositoryView::forEachReference(const std::function<int(GitReference &)> & func) const
 {
 	if (!data)
@@ -118,6 +126,26 @@ int GitRepositoryView::targetByName(git_oid * oid, const char *name) const
 	return ((data && oid && name) ? git_reference_name_to_id(oid, data, name) : GIT_ENOTFOUND);
 }
 
+GitOdb GitRepositoryView::odb() const
+{
+	GitOdb odb;
+	if (data)
+		git_repository_odb(odb.fill(), data);
+	return odb;
+}
+
+std::string GitRepositoryView::commonDir() const
+{
+	const char * path = (data ? git_repository_commondir(data) : nullptr);
+	return (path ? std::string(path) : std::string());
+}
+
+std::string GitRepositoryView::path() const
+{
+	const char * path = (data ? git_repository_path(data) : nullptr);
+	return (path ? std::string(path) : std::string());
+}
+
 GitReference GitReferenceView::dup() const
 {
 	GitReference ref;
@@ -222,6 +250,11 @@ GitTree GitCommitView::tree() const
 	return tree;
 }
 
+const git_oid *GitCommitView::treeId() const
+{
+	return (data ? git_commit_tree_id(data) : nullptr);
+}
+
 GitRepositoryView GitTreeView::owner() const
 {
 	return (data ? git_tree_owner(data) : nullptr);
@@ -242,6 +275,11 @@ GitTreeEntryView GitTreeView::byIndex(size_t index) const
 	return (data ? GitTreeEntryView(git_tree_entry_byindex(data, index)) : GitTreeEntryView());
 }
 
+GitTreeEntryView GitTreeView::byName(const char *name) const
+{
+	return (data && name ? GitTreeEntryView(git_tree_entry_byname(data, name)) : GitTreeEntryView());
+}
+
 GitTreeEntry GitTreeView::byPath(const char *path) const
 {
 	GitTreeEntry entry;
@@ -295,3 +333,9 @@ GitObject GitObjectView::peel(git_object_t type) const
 		git_object_peel(object.fill(), data, type);
 	return object;
 }
+
+int GitOdbView::readHeader(const git_oid * oid, size_t * size, git_object_t * type) const
+{
+	git_object_t dummy;
+	return ((data && oid && size) ? git_odb_read_header(size, type ? type : &dummy, data, oid) : GIT_ENOTFOUND);
+}
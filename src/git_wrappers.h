@@ -1,8 +1,10 @@
 #ifndef GIT_WRAPPERS_H_
 #define GIT_WRAPPERS_H_
 
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <string>
 #include <git2.h>
 
 class GitRepository;
@@ -15,12 +17,25 @@ class GitTree;
 class GitTreeEntry;
 class GitTreeEntryView;
 class GitObject;
+class GitOdb;
 
 inline bool operator== (const git_oid & lhs, const git_oid & rhs)
 {
 	return git_oid_equal(&lhs, &rhs);
 }
 
+struct GitOidHash
+{
+	inline size_t operator() (const git_oid & oid) const
+	{
+		// SHA1 hashes are uniformly distributed already
+		size_t hash;
+		static_assert(sizeof(hash) <= sizeof(oid.id), "oid too short to hash");
+		std::memcpy(&hash, oid.id, sizeof(hash));
+		return hash;
+	}
+};
+
 #define WRAPCOMMON(clz,typ) \
 	inline bool operator! () const { return data == nullptr; } \
 	inline bool operator== (const clz & other) const { return data == other.data; } \
@@ -69,9 +84,13 @@ public:
 	GitObject resolveObject(const git_oid * shortOid, size_t oidSize, git_object_t type = GIT_OBJECT_ANY) const;
 	GitTag resolveTag(const git_oid * oid) const;
 	GitTree resolveTree(const git_oid * oid) const;
+	GitObject revparse(const char *spec) const;
 	int forEachReference(const std::function<int(GitReference &)> & func) const;
 	int forEachReference(const std::function<int(const char *)> & func) const;
 	int targetByName(git_oid * oid, const char *name) const;
+	GitOdb odb() const;
+	std::string commonDir() const;
+	std::string path() const;
 };
 WRAPVIEW(GitRepository, git_repository, git_repository_free);
 
@@ -125,6 +144,7 @@ public:
 	GitObject object() const;
 	git_time_t time() const;
 	GitTree tree() const;
+	const git_oid *treeId() const;
 };
 WRAPVIEW(GitCommit, git_commit, git_commit_free);
 
@@ -142,6 +162,7 @@ public:
 	const git_oid *id() const;
 	size_t entryCount() const;
 	GitTreeEntryView byIndex(size_t index) const;
+	GitTreeEntryView byName(const char *name) const;
 	GitTreeEntry byPath(const char *path) const;
 };
 WRAPVIEW(GitTree, git_tree, git_tree_free);
@@ -168,6 +189,14 @@ public:
 };
 WRAPVIEW(GitObject, git_object, git_object_free);
 
+class GitOdbView
+{
+WRAP(GitOdbView, git_odb);
+public:
+	int readHeader(const git_oid * oid, size_t * size, git_object_t * type) const;
+};
+WRAPVIEW(GitOdb, git_odb, git_odb_free);
+
 #undef WRAP
 #undef WRAPCOMMON
 #undef WRAPVIEW
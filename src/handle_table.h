@@ -0,0 +1,199 @@
+#ifndef HANDLE_TABLE_H_
+#define HANDLE_TABLE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * Table of open handles stored in slabs of slots. A key encodes the slot
+ * index in the low 32 bits and the generation of the slot in the high bits,
+ * so a stale key never matches a reused slot. Lookups are plain atomic loads
+ * without locks or reference counting; this relies on the kernel never using
+ * a handle after it was released. Freed slots go to a per thread free list
+ * first and only spill into a shared, locked list when that one grows long.
+ * A thread hands its list back to the shared one when it exits or starts
+ * using another table.
+ */
+template <typename T>
+class HandleTable
+{
+public:
+	using Key = uint64_t;
+
+public:
+	HandleTable() : mChunks(new std::atomic<Slot*>[MaxChunks]), mNextSlot(0), mFree(std::make_shared<SharedFreeList>())
+	{
+		for (size_t i = 0; i < MaxChunks; ++i)
+			mChunks[i].store(nullptr, std::memory_order_relaxed);
+	}
+
+	HandleTable(const HandleTable & other) = delete;
+
+	~HandleTable()
+	{
+		for (size_t i = 0; i < MaxChunks; ++i)
+		{
+			Slot * chunk = mChunks[i].load(std::memory_order_relaxed);
+			if (!chunk)
+				continue;
+
+			for (size_t j = 0; j < ChunkSize; ++j)
+				delete chunk[j].value.load(std::memory_order_relaxed);
+			delete[] chunk;
+		}
+	}
+
+	Key insert(std::unique_ptr<T> value)
+	{
+		uint32_t index = allocateSlot();
+		Slot & slot = slotAt(index);
+		uint32_t generation = slot.generation.load(std::memory_order_relaxed);
+		slot.value.store(value.release(), std::memory_order_release);
+		return (Key(generation) << 32) | index;
+	}
+
+	T * find(Key key) const
+	{
+		uint32_t index = uint32_t(key);
+		Slot * chunk = (index >> ChunkBits) < MaxChunks ? mChunks[index >> ChunkBits].load(std::memory_order_acquire) : nullptr;
+		if (!chunk)
+			return nullptr;
+
+		const Slot & slot = chunk[index & ChunkMask];
+		if (slot.generation.load(std::memory_order_acquire) != uint32_t(key >> 32))
+			return nullptr;
+
+		return slot.value.load(std::memory_order_acquire);
+	}
+
+	std::unique_ptr<T> remove(Key key)
+	{
+		if (!find(key))
+			return nullptr;
+
+		uint32_t index = uint32_t(key);
+		Slot & slot = slotAt(index);
+
+		uint32_t generation = uint32_t(key >> 32);
+		if (!slot.generation.compare_exchange_strong(generation, generation + 1, std::memory_order_acq_rel))
+			return nullptr;
+
+		std::unique_ptr<T> value(slot.value.exchange(nullptr, std::memory_order_acq_rel));
+		freeSlot(index);
+		return value;
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<uint32_t> generation { 0 };
+		std::atomic<T*> value { nullptr };
+	};
+
+	struct SharedFreeList
+	{
+		std::mutex lock;
+		std::vector<uint32_t> slots;
+	};
+
+	// Keeps the shared list alive, the table may go before the thread
+	struct LocalFreeList
+	{
+		std::shared_ptr<SharedFreeList> owner;
+		std::vector<uint32_t> slots;
+
+		~LocalFreeList()
+		{
+			giveBack();
+		}
+
+		void giveBack()
+		{
+			if (owner && !slots.empty())
+			{
+				std::lock_guard<std::mutex> guard(owner->lock);
+				owner->slots.insert(owner->slots.end(), slots.begin(), slots.end());
+			}
+			slots.clear();
+		}
+	};
+
+	static constexpr size_t ChunkBits = 12;
+	static constexpr size_t ChunkSize = size_t(1) << ChunkBits;
+	static constexpr size_t ChunkMask = ChunkSize - 1;
+	static constexpr size_t MaxChunks = 4096;
+	static constexpr size_t LocalFreeMax = 256;
+
+	LocalFreeList & localFreeList()
+	{
+		static thread_local LocalFreeList list;
+		if (list.owner != mFree)
+		{
+			list.giveBack();
+			list.owner = mFree;
+		}
+		return list;
+	}
+
+	Slot & slotAt(uint32_t index)
+	{
+		return mChunks[index >> ChunkBits].load(std::memory_order_acquire)[index & ChunkMask];
+	}
+
+	uint32_t allocateSlot()
+	{
+		LocalFreeList & local = localFreeList();
+		if (local.slots.empty())
+		{
+			std::lock_guard<std::mutex> guard(mFree->lock);
+			size_t take = std::min(mFree->slots.size(), LocalFreeMax / 2);
+			local.slots.assign(mFree->slots.end() - take, mFree->slots.end());
+			mFree->slots.resize(mFree->slots.size() - take);
+		}
+
+		if (!local.slots.empty())
+		{
+			uint32_t index = local.slots.back();
+			local.slots.pop_back();
+			return index;
+		}
+
+		uint32_t index = mNextSlot.fetch_add(1, std::memory_order_relaxed);
+		if ((index >> ChunkBits) >= MaxChunks)
+			throw "Out of file handles";
+
+		std::atomic<Slot*> & chunk = mChunks[index >> ChunkBits];
+		if (!chunk.load(std::memory_order_acquire))
+		{
+			std::lock_guard<std::mutex> guard(mFree->lock);
+			if (!chunk.load(std::memory_order_relaxed))
+				chunk.store(new Slot[ChunkSize], std::memory_order_release);
+		}
+
+		return index;
+	}
+
+	void freeSlot(uint32_t index)
+	{
+		LocalFreeList & local = localFreeList();
+		local.slots.push_back(index);
+
+		if (local.slots.size() > LocalFreeMax)
+		{
+			std::lock_guard<std::mutex> guard(mFree->lock);
+			size_t spill = local.slots.size() / 2;
+			mFree->slots.insert(mFree->slots.end(), local.slots.end() - spill, local.slots.end());
+			local.slots.resize(local.slots.size() - spill);
+		}
+	}
+
+	std::unique_ptr<std::atomic<Slot*>[]> mChunks;
+	std::atomic<uint32_t> mNextSlot;
+	std::shared_ptr<SharedFreeList> mFree;
+};
+
+#endif // HANDLE_TABLE_H_
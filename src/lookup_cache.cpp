@@ -0,0 +1,68 @@
+#include "lookup_cache.h"
+#include <functional>
+
+LookupCache::LookupCache(size_t maxEntries) : mEntries(maxEntries), mMisses(maxEntries / 4)
+{
+}
+
+LookupCache::~LookupCache()
+{
+}
+
+size_t LookupCache::KeyHash::operator() (const Key & key) const
+{
+	size_t hash = std::hash<std::string>()(key.name);
+	return hash ^ (std::hash<const void *>()(key.parent) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+}
+
+bool LookupCache::isValid(const Value & value)
+{
+	if (value.generation != value.parent->generation())
+		return false;
+
+	return !value.target || !value.target->isUnlinked();
+}
+
+bool LookupCache::find(const FSEntryPtr & parent, std::string_view segment, FSEntryPtr & target) const
+{
+	Key key { parent.get(), std::string(segment) };
+
+	auto accept = [&target] (const Value & value) -> bool
+	{
+		if (!isValid(value))
+			return false;
+
+		target = value.target;
+		return true;
+	};
+
+	return mEntries.find(key, accept) || mMisses.find(key, accept);
+}
+
+void LookupCache::insert(const FSEntryPtr & parent, std::string_view segment, const FSEntryPtr & target, uint64_t generation)
+{
+	if (!parent)
+		return;
+
+	Key key { parent.get(), std::string(segment) };
+	Value value { parent, target, generation };
+
+	if (target)
+		mEntries.insert(std::move(key), std::move(value));
+	else
+		mMisses.insert(std::move(key), std::move(value));
+}
+
+size_t LookupCache::purgeStale()
+{
+	size_t count = mEntries.eraseIf([] (const Key &, const Value & value) -> bool { return !isValid(value); });
+	count += mMisses.size();
+	mMisses.clear();
+	return count;
+}
+
+void LookupCache::clear()
+{
+	mEntries.clear();
+	mMisses.clear();
+}
@@ -0,0 +1,66 @@
+#ifndef LOOKUP_CACHE_H_
+#define LOOKUP_CACHE_H_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include "fs_entry.h"
+#include "sharded_map.h"
+
+/*
+ * Caches the result of FSEntry::getChild for a single path segment, keyed by
+ * the parent node and the segment name. Entries are validated against the
+ * generation of the parent so that mutable pseudo directories invalidate
+ * themselves whenever their children change; nodes with a constant generation
+ * (everything below a commit) stay valid forever.
+ *
+ * Misses are only remembered here for mutable parents, they are kept in a
+ * separate table that is dropped completely whenever the refs are rebuilt.
+ * Misses inside immutable trees are remembered by FSTree itself.
+ */
+class LookupCache
+{
+public:
+	LookupCache(size_t maxEntries = 1 << 20);
+	LookupCache(const LookupCache & other) = delete;
+	~LookupCache();
+
+	// Returns true if the segment is cached, target is left empty for a known miss
+	bool find(const FSEntryPtr & parent, std::string_view segment, FSEntryPtr & target) const;
+
+	// The generation must be read from the parent *before* resolving the child
+	// so a concurrent change to the parent can only make the entry look stale.
+	// An empty target records a miss.
+	void insert(const FSEntryPtr & parent, std::string_view segment, const FSEntryPtr & target, uint64_t generation);
+
+	size_t purgeStale();
+	void clear();
+
+private:
+	struct Key
+	{
+		const FSEntry * parent;
+		std::string name;
+
+		inline bool operator== (const Key & other) const { return parent == other.parent && name == other.name; }
+	};
+
+	struct KeyHash
+	{
+		size_t operator() (const Key & key) const;
+	};
+
+	struct Value
+	{
+		FSEntryPtr parent;
+		FSEntryPtr target;
+		uint64_t generation;
+	};
+
+	static bool isValid(const Value & value);
+
+	ShardedMap<Key, Value, KeyHash> mEntries;
+	ShardedMap<Key, Value, KeyHash> mMisses;
+};
+
+#endif // LOOKUP_CACHE_H_
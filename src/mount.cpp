@@ -1,7 +1,11 @@
+#include <charconv>
+#include <cstdint>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <string>
 #include <git2.h>
-#include <fuse.h>
+#include <fuse_lowlevel.h>
 #include "gitfs.h"
 #include "command_line.h"
 #include "mount_context.h"
@@ -21,8 +25,74 @@ enum cmdline_option_keys
 	KEY_COMMIT,
 	KEY_READONLY,
 	KEY_READWRITE,
+	KEY_BLOB_CACHE,
+	KEY_OBJECT_CACHE,
+	KEY_REPO_HANDLES,
+	KEY_UID,
+	KEY_GID,
+	KEY_UMASK,
+	KEY_IO_URING,
+	KEY_IO_URING_DEPTH,
+	KEY_BACKING_DIR,
+	KEY_BACKING_SIZE,
+	KEY_PASSTHROUGH_SIZE,
+	KEY_PASSTHROUGH_OPENS,
+	KEY_ASYNC_THREADS,
+	KEY_PREFETCH,
+	KEY_PREFETCH_THREADS,
+	KEY_PROFILE,
+	KEY_PROFILE_TIME,
+	KEY_TREE_INDEX,
+	KEY_TREE_INDEX_SIZE,
 };
 
+// Parses a byte count with an optional K, M or G suffix
+bool parse_size(const std::string_view & value, size_t & result)
+{
+	size_t number = 0;
+	auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+	if (ec != std::errc() || ptr == value.data())
+		return false;
+
+	std::string_view suffix(ptr, value.data() + value.size() - ptr);
+	unsigned int shift = 0;
+	if (suffix == "K" || suffix == "k")
+		shift = 10;
+	else if (suffix == "M" || suffix == "m")
+		shift = 20;
+	else if (suffix == "G" || suffix == "g")
+		shift = 30;
+	else if (!suffix.empty())
+		return false;
+
+	// Sizes that don't fit are rejected rather than wrapped around
+	if (number > (SIZE_MAX >> shift))
+		return false;
+
+	result = number << shift;
+	return true;
+}
+
+// Parses a plain number in the given base, the whole value must be used
+template <typename T>
+bool parse_number(const std::string_view & value, T & result, int base = 10)
+{
+	auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), result, base);
+	return ec == std::errc() && ptr != value.data() && ptr == value.data() + value.size();
+}
+
+// FUSE over io_uring needs libfuse 3.18 and a kernel that has it enabled
+bool io_uring_supported()
+{
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 18)
+	std::ifstream param("/sys/module/fuse/parameters/enable_uring");
+	std::string value;
+	return (param >> value) && (value == "Y" || value == "1");
+#else
+	return false;
+#endif
+}
+
 int mount_main_cmdline(int key, const std::string_view & argument, const std::string_view & value, void *data)
 {
 	struct MountContext *context = reinterpret_cast<MountContext*>(data);
@@ -75,6 +145,145 @@ int mount_main_cmdline(int key, const std::string_view & argument, const std::st
 		case KEY_READWRITE:
 			context->readwrite = true;
 			return 1;
+
+		case KEY_BLOB_CACHE:
+			if (!parse_size(value, context->blobCacheSize))
+			{
+				std::cerr << "gitfs mount: invalid blob cache size: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_OBJECT_CACHE:
+			if (!parse_size(value, context->objectCacheSize))
+			{
+				std::cerr << "gitfs mount: invalid object cache size: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_REPO_HANDLES:
+			if (!parse_number(value, context->repositoryHandles) || context->repositoryHandles == 0)
+			{
+				std::cerr << "gitfs mount: invalid number of repository handles: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_UID:
+			context->setUid = parse_number(value, context->uid);
+			if (!context->setUid)
+			{
+				std::cerr << "gitfs mount: invalid uid: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_GID:
+			context->setGid = parse_number(value, context->gid);
+			if (!context->setGid)
+			{
+				std::cerr << "gitfs mount: invalid gid: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_IO_URING:
+			context->ioUring = true;
+			return 0;
+
+		case KEY_IO_URING_DEPTH:
+			if (!parse_number(value, context->ioUringDepth) || context->ioUringDepth == 0)
+			{
+				std::cerr << "gitfs mount: invalid io_uring queue depth: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_BACKING_DIR:
+			context->backingDir = value;
+			return 0;
+
+		case KEY_BACKING_SIZE:
+			if (!parse_size(value, context->backingSize))
+			{
+				std::cerr << "gitfs mount: invalid backing directory size: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_PASSTHROUGH_SIZE:
+			if (!parse_size(value, context->passthroughSize))
+			{
+				std::cerr << "gitfs mount: invalid passthrough size: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_PASSTHROUGH_OPENS:
+			if (!parse_number(value, context->passthroughOpens) || context->passthroughOpens == 0)
+			{
+				std::cerr << "gitfs mount: invalid number of passthrough opens: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_ASYNC_THREADS:
+			if (!parse_number(value, context->asyncThreads))
+			{
+				std::cerr << "gitfs mount: invalid number of async threads: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_PREFETCH:
+			if (!parse_size(value, context->prefetchBudget))
+			{
+				std::cerr << "gitfs mount: invalid prefetch budget: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_PREFETCH_THREADS:
+			if (!parse_number(value, context->prefetchThreads))
+			{
+				std::cerr << "gitfs mount: invalid number of prefetch threads: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_PROFILE:
+			context->profilePath = value;
+			return 0;
+
+		case KEY_PROFILE_TIME:
+			if (!parse_number(value, context->profileSeconds) || context->profileSeconds == 0)
+			{
+				std::cerr << "gitfs mount: invalid profile time: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_TREE_INDEX:
+			context->treeIndexPath = value;
+			return 0;
+
+		case KEY_TREE_INDEX_SIZE:
+			if (!parse_size(value, context->treeIndexSize))
+			{
+				std::cerr << "gitfs mount: invalid tree index size: " << value << std::endl;
+				return -1;
+			}
+			return 0;
+
+		case KEY_UMASK:
+			context->setUmask = parse_number(value, context->umask, 8);
+			if (!context->setUmask)
+			{
+				std::cerr << "gitfs mount: invalid umask: " << value << std::endl;
+				return -1;
+			}
+			return 0;
 	}
 
 	return 1;
@@ -92,7 +301,27 @@ void mount_main_cmdhelp()
 			<< std::endl
 			<< "GITFS options:" << std::endl
 			<< "    -o branch=STR          mount the tip of a specific branch" << std::endl
-			<< "    -o commit=STR          mount a specific commit or tag" << std::endl;
+			<< "    -o commit=STR          mount a specific commit or tag" << std::endl
+			<< "    -o blob_cache=SIZE     memory budget for inflated blobs (default 256M)" << std::endl
+			<< "    -o object_cache=SIZE   libgit2 object cache limit over all handles" << std::endl
+			<< "    -o repo_handles=N      repository handles shared by the workers (default: nr of cpus)" << std::endl
+			<< "    -o uid=N               owner of all files (default: mounting user)" << std::endl
+			<< "    -o gid=N               group of all files (default: mounting group)" << std::endl
+			<< "    -o umask=M             permissions to remove from all files (default: 022)" << std::endl
+			<< "    -o io_uring            serve requests from per-cpu io_uring queues if supported" << std::endl
+			<< "    -o io_uring_depth=N    depth of each io_uring queue" << std::endl
+			<< "    -o backing_dir=PATH    store hot blobs here, shared by mounts and kept across them" << std::endl
+			<< "    -o backing_size=SIZE   trim the least recently used stored blobs beyond this, 0 for no limit;" << std::endl
+			<< "                           the tree index has its own limit" << std::endl
+			<< "    -o passthrough_size=SIZE  store blobs of at least this size (default 1M)" << std::endl
+			<< "    -o passthrough_opens=N    store blobs opened this often (default 4)" << std::endl
+			<< "    -o async_threads=N     threads for inflating requests, 0 runs them in place (default: nr of cpus)" << std::endl
+			<< "    -o prefetch=SIZE       blob bytes prefetched at once for walking processes, 0 disables (default 64M)" << std::endl
+			<< "    -o prefetch_threads=N  threads prefetching trees and blobs (default: half the nr of cpus)" << std::endl
+			<< "    -o profile=PATH        warm up what the last mount touched first and record this one" << std::endl
+			<< "    -o profile_time=N      seconds of each mount that are recorded (default 60)" << std::endl
+			<< "    -o tree_index=PATH     keep decoded trees here across mounts (default: in backing_dir if set)" << std::endl
+			<< "    -o tree_index_size=SIZE  drop the trees used longest ago beyond this, 0 for no limit (default 512M)" << std::endl;
 }
 
 int mount_main(int argc, char **argv)
@@ -107,6 +336,25 @@ int mount_main(int argc, char **argv)
 	cmdline.add(KEY_READWRITE, "rw");
 	cmdline.add(KEY_BRANCH, "branch=");
 	cmdline.add(KEY_COMMIT, "commit=");
+	cmdline.add(KEY_BLOB_CACHE, "blob_cache=");
+	cmdline.add(KEY_OBJECT_CACHE, "object_cache=");
+	cmdline.add(KEY_REPO_HANDLES, "repo_handles=");
+	cmdline.add(KEY_UID, "uid=");
+	cmdline.add(KEY_GID, "gid=");
+	cmdline.add(KEY_UMASK, "umask=");
+	cmdline.add(KEY_IO_URING, "io_uring");
+	cmdline.add(KEY_IO_URING_DEPTH, "io_uring_depth=");
+	cmdline.add(KEY_BACKING_DIR, "backing_dir=");
+	cmdline.add(KEY_BACKING_SIZE, "backing_size=");
+	cmdline.add(KEY_PASSTHROUGH_SIZE, "passthrough_size=");
+	cmdline.add(KEY_PASSTHROUGH_OPENS, "passthrough_opens=");
+	cmdline.add(KEY_ASYNC_THREADS, "async_threads=");
+	cmdline.add(KEY_PREFETCH, "prefetch=");
+	cmdline.add(KEY_PREFETCH_THREADS, "prefetch_threads=");
+	cmdline.add(KEY_PROFILE, "profile=");
+	cmdline.add(KEY_PROFILE_TIME, "profile_time=");
+	cmdline.add(KEY_TREE_INDEX, "tree_index=");
+	cmdline.add(KEY_TREE_INDEX_SIZE, "tree_index_size=");
 	cmdline.parse(&mount_main_cmdline, &mountcontext);
 
 	if (cmdline.hasHelp())
@@ -115,7 +363,8 @@ int mount_main(int argc, char **argv)
 		mount_main_cmdhelp();
 
 		std::cout << std::endl << "FUSE options:" << std::endl;
-		fuse_lib_help(cmdline.args());
+		fuse_cmdline_help();
+		fuse_lowlevel_help();
 
 		return EXIT_SUCCESS;
 	}
@@ -135,6 +384,18 @@ int mount_main(int argc, char **argv)
 	cmdline.pushArg("-onoatime");
 	cmdline.pushArg("-oauto_unmount");
 
+	// libfuse sets up one queue per cpu, without support stay on /dev/fuse
+	if (mountcontext.ioUring && io_uring_supported())
+	{
+		cmdline.pushArg("-oio_uring");
+		if (mountcontext.ioUringDepth)
+			cmdline.pushArg(("-oio_uring_q_depth=" + std::to_string(mountcontext.ioUringDepth)).c_str());
+	}
+	else if (mountcontext.ioUring)
+	{
+		std::cerr << "gitfs mount: FUSE over io_uring is not supported here, using /dev/fuse" << std::endl;
+	}
+
 	if (!git_libgit2_init())
 	{
 		std::cerr << "error initializing libgit" << std::endl;
@@ -155,9 +416,45 @@ int mount_main(int argc, char **argv)
 	if (mountcontext.debug)
 		std::cout << "mount: located and opened at " << git_repository_path(mountcontext.repository) << std::endl;
 
-	int result = fuse_main(cmdline.args()->argc, cmdline.args()->argv, GitContext::fuseOperations(), &mountcontext);
-	if (result == 2) // No mount point specified
+	struct fuse_cmdline_opts opts = {};
+	if (fuse_parse_cmdline(cmdline.args(), &opts) != 0)
+		return EXIT_FAILURE;
+
+	if (!opts.mountpoint)
+	{
 		mount_main_cmdhelp();
+		return 2;
+	}
+
+	int result = EXIT_FAILURE;
+	{
+		GitContext context(mountcontext);
+
+		struct fuse_session *session = nullptr;
+		if (context.nodes)
+			session = fuse_session_new(cmdline.args(), GitContext::fuseOperations(), sizeof(fuse_lowlevel_ops), &context);
+		if (session)
+		{
+			context.session = session;
+			if (fuse_set_signal_handlers(session) == 0)
+			{
+				if (fuse_session_mount(session, opts.mountpoint) == 0)
+				{
+					fuse_daemonize(opts.foreground);
+
+					if (opts.singlethread)
+						result = fuse_session_loop(session);
+					else
+						result = fuse_session_loop_mt(session, opts.clone_fd);
+
+					fuse_session_unmount(session);
+				}
+				fuse_remove_signal_handlers(session);
+			}
+			fuse_session_destroy(session);
+		}
+	}
+	free(opts.mountpoint);
 
 	git_libgit2_shutdown();
 	return result;
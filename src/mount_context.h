@@ -1,7 +1,10 @@
 #ifndef MOUNT_CONTEXT_H_
 #define MOUNT_CONTEXT_H_
 
+#include <algorithm>
 #include <string>
+#include <thread>
+#include <sys/types.h>
 struct git_repository;
 
 struct MountContext
@@ -15,6 +18,28 @@ struct MountContext
 	bool foreground = false;
 	bool debug = false;
 	bool readwrite = true;
+	bool ioUring = false;
+	unsigned int ioUringDepth = 0;
+	bool setUid = false;
+	bool setGid = false;
+	bool setUmask = false;
+	uid_t uid = 0;
+	gid_t gid = 0;
+	mode_t umask = 0;
+	size_t blobCacheSize = 256 << 20;
+	size_t objectCacheSize = 0;
+	std::string backingDir;
+	size_t backingSize = 0;
+	std::string treeIndexPath;
+	size_t treeIndexSize = size_t(512) << 20;
+	size_t passthroughSize = 1 << 20;
+	unsigned int passthroughOpens = 4;
+	size_t repositoryHandles = std::max(std::thread::hardware_concurrency(), 1u);
+	size_t asyncThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	size_t prefetchBudget = 64 << 20;
+	size_t prefetchThreads = std::max(std::thread::hardware_concurrency() / 2, 1u);
+	std::string profilePath;
+	unsigned int profileSeconds = 60;
 };
 
 #endif // MOUNT_CONTEXT_H_
@@ -0,0 +1,81 @@
+#include "node_table.h"
+#include <functional>
+
+NodeTable::NodeTable(FSEntryPtr root) : mRoot { RootId, std::string(), std::move(root), 1, false }
+{
+	mShards.reset(new Shard[NrShards]);
+}
+
+NodeTable::~NodeTable()
+{
+}
+
+size_t NodeTable::KeyHash::operator() (const Key & key) const
+{
+	size_t hash = std::hash<std::string_view>()(key.name);
+	return hash ^ (std::hash<NodeId>()(key.parent) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+}
+
+NodeTable::Shard & NodeTable::shardFor(const Key & key) const
+{
+	return mShards[(KeyHash()(key) >> 7) % NrShards];
+}
+
+NodeTable::NodeId NodeTable::acquire(NodeId parent, std::string_view name, const FSEntryPtr & entry)
+{
+	Key key { parent, name };
+	Shard & shard = shardFor(key);
+
+	std::lock_guard<std::mutex> guard(shard.lock);
+	auto iter = shard.nodes.find(key);
+	if (iter != shard.nodes.end())
+	{
+		Node * node = iter->second.get();
+		if (node->entry == entry)
+		{
+			++node->lookups;
+			return NodeId(reinterpret_cast<uintptr_t>(node));
+		}
+
+		// The name shows another entry now; the kernel may still use the old
+		// node id, so the node stays until it is forgotten
+		node->detached = true;
+		shard.detached.emplace(node, std::move(iter->second));
+		shard.nodes.erase(iter);
+	}
+
+	std::unique_ptr<Node> node(new Node { parent, std::string(name), entry, 1, false });
+	Node * created = node.get();
+	shard.nodes.emplace(Key { parent, created->name }, std::move(node));
+	return NodeId(reinterpret_cast<uintptr_t>(created));
+}
+
+void NodeTable::forget(NodeId id, uint64_t lookups)
+{
+	// The root is never forgotten
+	if (id == RootId)
+		return;
+
+	Node * node = find(id);
+	Key key { node->parent, node->name };
+	Shard & shard = shardFor(key);
+
+	std::lock_guard<std::mutex> guard(shard.lock);
+	if (node->lookups > lookups)
+		node->lookups -= lookups;
+	else if (node->detached)
+		shard.detached.erase(node);
+	else
+		shard.nodes.erase(shard.nodes.find(key));
+}
+
+size_t NodeTable::size() const
+{
+	size_t count = 0;
+	for (size_t i = 0; i < NrShards; ++i)
+	{
+		std::lock_guard<std::mutex> guard(mShards[i].lock);
+		count += mShards[i].nodes.size();
+	}
+	return count;
+}
@@ -0,0 +1,98 @@
+#ifndef NODE_TABLE_H_
+#define NODE_TABLE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "fs_entry.h"
+
+/*
+ * Node ids handed to the kernel by the low level FUSE interface. A node id
+ * is the address of a Node, so resolving one never takes a lock. Nodes are
+ * keyed by their parent node and name: entries are shared per tree oid, but
+ * the same tree at two paths gets two node ids, the kernel doesn't allow
+ * directories to alias. A node lives until the kernel forgets every lookup
+ * it was handed out for, even once its name shows another entry.
+ */
+class NodeTable
+{
+public:
+	using NodeId = uint64_t;
+	static constexpr NodeId RootId = 1;
+
+	struct Node
+	{
+		NodeId parent;
+		std::string name;
+		FSEntryPtr entry;
+		uint64_t lookups;
+		bool detached;
+	};
+
+public:
+	NodeTable(FSEntryPtr root);
+	NodeTable(const NodeTable & other) = delete;
+	~NodeTable();
+
+	// Node of a node id the kernel knows about
+	inline Node * find(NodeId id) const
+	{
+		return (id == RootId ? &mRoot : reinterpret_cast<Node *>(uintptr_t(id)));
+	}
+
+	// Node id of entry as name below parent, raises its lookup count by one
+	NodeId acquire(NodeId parent, std::string_view name, const FSEntryPtr & entry);
+	void forget(NodeId id, uint64_t lookups);
+
+	// Calls func(id, node) for every node including the root, under the
+	// lock of its shard
+	template <typename Function>
+	void forEach(Function && func) const
+	{
+		func(RootId, mRoot);
+		for (size_t i = 0; i < NrShards; ++i)
+		{
+			std::lock_guard<std::mutex> guard(mShards[i].lock);
+			for (const auto & iter : mShards[i].nodes)
+				func(NodeId(reinterpret_cast<uintptr_t>(iter.second.get())), *iter.second);
+		}
+	}
+
+	size_t size() const;
+
+private:
+	// The name points into the node it is the key of
+	struct Key
+	{
+		NodeId parent;
+		std::string_view name;
+
+		inline bool operator== (const Key & other) const { return parent == other.parent && name == other.name; }
+	};
+
+	struct KeyHash
+	{
+		size_t operator() (const Key & key) const;
+	};
+
+	struct Shard
+	{
+		mutable std::mutex lock;
+		std::unordered_map<Key, std::unique_ptr<Node>, KeyHash> nodes;
+		// Nodes whose name shows another entry by now, until they are forgotten
+		std::unordered_map<const Node *, std::unique_ptr<Node>> detached;
+	};
+
+	static constexpr size_t NrShards = 64;
+
+	Shard & shardFor(const Key & key) const;
+
+	mutable Node mRoot;
+	std::unique_ptr<Shard[]> mShards;
+};
+
+#endif // NODE_TABLE_H_
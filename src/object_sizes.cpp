@@ -0,0 +1,62 @@
+#include "object_sizes.h"
+#include "batch_loader.h"
+#include "repository_pool.h"
+
+ShardedMap<git_oid, off_t, GitOidHash> ObjectSizes::gSizes(1 << 20);
+
+off_t ObjectSizes::objectSize(const GitRepositoryView & repo, const git_oid * oid)
+{
+	if (!oid)
+		return 0;
+
+	off_t size = 0;
+	if (gSizes.find(*oid, size))
+		return size;
+
+	size_t headerSize = 0;
+	GitOdb odb = RepositoryPool::local(repo).odb();
+	if (odb.readHeader(oid, &headerSize, nullptr) != 0)
+		return 0;
+
+	size = off_t(headerSize);
+	gSizes.insert(*oid, size);
+	return size;
+}
+
+void ObjectSizes::remember(const git_oid & oid, off_t size)
+{
+	gSizes.insert(oid, size);
+}
+
+std::vector<off_t> ObjectSizes::objectSizes(const GitRepositoryView & repo, const std::vector<git_oid> & oids)
+{
+	std::vector<off_t> sizes(oids.size(), 0);
+	std::vector<size_t> missing;
+	BatchLoader batch(repo);
+
+	for (size_t i = 0; i < oids.size(); ++i)
+	{
+		if (!gSizes.find(oids[i], sizes[i]))
+		{
+			missing.push_back(i);
+			batch.add(oids[i]);
+		}
+	}
+
+	if (missing.empty())
+		return sizes;
+
+	GitOdb odb = RepositoryPool::local(repo).odb();
+	batch.run([&] (size_t index, const git_oid & oid)
+	{
+		size_t headerSize = 0;
+		if (odb.readHeader(&oid, &headerSize, nullptr) == 0)
+		{
+			sizes[missing[index]] = off_t(headerSize);
+			gSizes.insert(oid, off_t(headerSize));
+		}
+		return true;
+	});
+
+	return sizes;
+}
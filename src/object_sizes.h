@@ -0,0 +1,27 @@
+#ifndef OBJECT_SIZES_H_
+#define OBJECT_SIZES_H_
+
+#include <vector>
+#include <sys/types.h>
+#include "git_wrappers.h"
+#include "sharded_map.h"
+
+/*
+ * Object sizes as stored in the object header, memoized per oid. Reading the
+ * header of a packed object does not inflate its content, so filling st_size
+ * costs the same regardless of how large the object is.
+ */
+class ObjectSizes
+{
+public:
+	static off_t objectSize(const GitRepositoryView & repo, const git_oid * oid);
+	// Sizes of many objects at once, the headers are read in pack order
+	static std::vector<off_t> objectSizes(const GitRepositoryView & repo, const std::vector<git_oid> & oids);
+	// Size known from elsewhere, like a tree listing kept on disk
+	static void remember(const git_oid & oid, off_t size);
+
+private:
+	static ShardedMap<git_oid, off_t, GitOidHash> gSizes;
+};
+
+#endif // OBJECT_SIZES_H_
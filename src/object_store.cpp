@@ -0,0 +1,308 @@
+#include "object_store.h"
+#include "atomic_file.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <ctime>
+#include <string_view>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr size_t CopyChunk = 1 << 20;
+
+// Use refreshes the mtime at most this often, in seconds
+constexpr time_t TouchInterval = 60;
+// Trimming goes this far below the limit, so it doesn't run on every store
+constexpr uint64_t TrimPercent = 90;
+// Temporary files of a writer that crashed are removed after an hour
+constexpr time_t StaleTemporary = 3600;
+// Blobs waiting to be stored beyond which new ones are not queued
+constexpr size_t MaxQueued = 256;
+
+} // namespace
+
+ObjectStore & ObjectStore::instance()
+{
+	static ObjectStore store;
+	return store;
+}
+
+ObjectStore::ObjectStore() : mSizeThreshold(1 << 20), mOpenThreshold(4), mOpens(1 << 16), mLimit(0), mBytes(0), mStopping(false)
+{
+}
+
+ObjectStore::~ObjectStore()
+{
+	stop();
+}
+
+bool ObjectStore::setDirectory(const std::string & path)
+{
+	if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST)
+		return false;
+
+	// The mount daemonizes into /, keep an absolute path
+	char * resolved = realpath(path.c_str(), nullptr);
+	if (!resolved)
+		return false;
+
+	mDirectory = resolved;
+	free(resolved);
+	return true;
+}
+
+void ObjectStore::setThresholds(off_t size, unsigned int opens)
+{
+	mSizeThreshold = size;
+	mOpenThreshold = opens;
+}
+
+void ObjectStore::setLimit(uint64_t bytes)
+{
+	mLimit = bytes;
+}
+
+std::string ObjectStore::pathOf(const git_oid & oid) const
+{
+	char hex[GIT_OID_HEXSZ + 1];
+	git_oid_tostr(hex, sizeof(hex), &oid);
+
+	std::string path = mDirectory;
+	path += '/';
+	path.append(hex, 2);
+	path += '/';
+	path.append(hex + 2);
+	return path;
+}
+
+int ObjectStore::open(const git_oid & oid) const
+{
+	if (!enabled())
+		return -1;
+
+	int fd = ::open(pathOf(oid).c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd >= 0)
+		touch(fd);
+	return fd;
+}
+
+std::shared_ptr<const char> ObjectStore::map(const git_oid & oid, size_t & size) const
+{
+	int fd = open(oid);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	size = st.st_size;
+	if (size == 0)
+	{
+		close(fd);
+		return std::shared_ptr<const char>("", [] (const char *) {});
+	}
+
+	// The mapping keeps the content even if the file is trimmed meanwhile
+	void * data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	return std::shared_ptr<const char>(static_cast<const char *>(data), [size] (const char * data)
+	{
+		munmap(const_cast<char *>(data), size);
+	});
+}
+
+void ObjectStore::touch(int fd) const
+{
+	// Files are read-only, but their owner may still set the times; other
+	// users sharing the directory just don't count as use
+	struct stat st;
+	if (fstat(fd, &st) == 0 && time(nullptr) - st.st_mtime >= TouchInterval)
+		futimens(fd, nullptr);
+}
+
+bool ObjectStore::wanted(const git_oid & oid, off_t size)
+{
+	if (!enabled())
+		return false;
+
+	if (size >= mSizeThreshold)
+		return true;
+
+	// Racing opens may lose a count, the threshold is only a heuristic
+	unsigned int opens = 0;
+	mOpens.find(oid, opens);
+	mOpens.insert(oid, ++opens);
+	return opens >= mOpenThreshold;
+}
+
+bool ObjectStore::store(const git_oid & oid, off_t size, const ReadFunction & read)
+{
+	if (!enabled())
+		return false;
+
+	std::string path = pathOf(oid);
+	std::string dir = path.substr(0, mDirectory.size() + 3);
+	if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+		return false;
+
+	AtomicFile file(path);
+	std::vector<char> buffer(CopyChunk);
+	bool success = file.valid();
+	off_t offset = 0;
+
+	while (success && offset < size)
+	{
+		int got = read(buffer.data(), buffer.size(), offset);
+		if (got <= 0)
+			success = false;
+		else
+			success = file.write(buffer.data(), got);
+		offset += got;
+	}
+
+	if (!success || !file.commit(0444))
+		return false;
+
+	mOpens.erase(oid);
+	mBytes += size;
+	return true;
+}
+
+void ObjectStore::trim()
+{
+	struct File
+	{
+		struct timespec used;
+		uint64_t size;
+		std::string path;
+	};
+
+	std::vector<File> files;
+	uint64_t total = 0;
+	time_t now = time(nullptr);
+
+	static const char HexDigits[] = "0123456789abcdef";
+	for (int i = 0; i < 256; ++i)
+	{
+		std::string dirPath = mDirectory + '/' + HexDigits[i >> 4] + HexDigits[i & 15];
+		DIR * dir = opendir(dirPath.c_str());
+		if (!dir)
+			continue;
+
+		while (struct dirent * entry = readdir(dir))
+		{
+			std::string_view name(entry->d_name);
+			if (name == "." || name == "..")
+				continue;
+
+			struct stat st;
+			std::string path = dirPath + '/' + entry->d_name;
+			if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode))
+				continue;
+
+			if (name.substr(0, 5) == ".tmp.")
+			{
+				if (now - st.st_mtime >= StaleTemporary)
+					unlink(path.c_str());
+				continue;
+			}
+
+			total += st.st_size;
+			files.push_back(File{ st.st_mtim, uint64_t(st.st_size), std::move(path) });
+		}
+
+		closedir(dir);
+	}
+
+	mBytes = total;
+	if (total <= mLimit)
+		return;
+
+	std::sort(files.begin(), files.end(), [] (const File & lhs, const File & rhs)
+	{
+		if (lhs.used.tv_sec != rhs.used.tv_sec)
+			return lhs.used.tv_sec < rhs.used.tv_sec;
+		return lhs.used.tv_nsec < rhs.used.tv_nsec;
+	});
+
+	// Open descriptors and mappings of removed files stay valid
+	uint64_t target = mLimit / 100 * TrimPercent;
+	for (const File & file : files)
+	{
+		if (total <= target)
+			break;
+		if (unlink(file.path.c_str()) == 0 || errno == ENOENT)
+			total -= file.size;
+	}
+
+	mBytes = total;
+}
+
+void ObjectStore::storeLater(const git_oid & oid, off_t size, SourceFunction source)
+{
+	std::lock_guard<std::mutex> guard(mQueueLock);
+	if (mStopping || mQueue.size() >= MaxQueued || !mQueued.insert(oid).second)
+		return;
+
+	// Started on first use, which is after the mount daemonized
+	if (!mThread.joinable())
+		mThread = std::thread(&ObjectStore::run, this);
+
+	mQueue.push_back(Pending{ oid, size, std::move(source) });
+	mQueueWake.notify_one();
+}
+
+void ObjectStore::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(mQueueLock);
+		mStopping = true;
+		mQueue.clear();
+	}
+	mQueueWake.notify_all();
+
+	if (mThread.joinable())
+		mThread.join();
+}
+
+void ObjectStore::run()
+{
+	// Other mounts store into the directory too, what it holds is only known
+	// after a scan. Later the count is kept up to date by the stores here.
+	if (mLimit)
+		trim();
+
+	std::unique_lock<std::mutex> lock(mQueueLock);
+	while (true)
+	{
+		mQueueWake.wait(lock, [this] { return mStopping || !mQueue.empty(); });
+		if (mStopping)
+			break;
+
+		Pending pending = std::move(mQueue.front());
+		mQueue.pop_front();
+		lock.unlock();
+
+		ReadFunction read = pending.source();
+		if (read && store(pending.oid, pending.size, read) && mLimit && mBytes > mLimit)
+			trim();
+
+		lock.lock();
+		mQueued.erase(pending.oid);
+	}
+}
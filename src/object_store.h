@@ -0,0 +1,98 @@
+#ifndef OBJECT_STORE_H_
+#define OBJECT_STORE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <sys/types.h>
+#include "git_wrappers.h"
+#include "sharded_map.h"
+
+/*
+ * Local directory of inflated blob contents, one read-only file per oid laid
+ * out like a loose object directory. Blobs are materialized once they are
+ * large enough or have been opened often enough, after which their files
+ * can back FUSE passthrough so reads never reach gitfs at all. Files are
+ * written to a temporary name, synced and renamed, so neither a reader nor a
+ * crash leaves a partial one behind, and the directory can be shared by any
+ * number of mounts and outlives them. Using a file refreshes its mtime; once
+ * the directory outgrows its limit the least recently used files go first.
+ */
+class ObjectStore
+{
+public:
+	// Reads up to bufsize bytes of the content at offset, like pread
+	using ReadFunction = std::function<int(char * buffer, size_t bufsize, off_t offset)>;
+	// Opens the content to store, called on the store's own thread
+	using SourceFunction = std::function<ReadFunction()>;
+
+public:
+	static ObjectStore & instance();
+
+	// Enables the store, creating the directory when needed
+	bool setDirectory(const std::string & path);
+	void setThresholds(off_t size, unsigned int opens);
+	// Bytes kept in the directory over all mounts sharing it, 0 for no limit
+	void setLimit(uint64_t bytes);
+
+	inline bool enabled() const { return !mDirectory.empty(); }
+	inline const std::string & directory() const { return mDirectory; }
+
+	// Descriptor of the stored content of oid, or -1 if it isn't stored
+	int open(const git_oid & oid) const;
+
+	// Read-only mapping of the stored content of oid, null if it isn't stored
+	std::shared_ptr<const char> map(const git_oid & oid, size_t & size) const;
+
+	// Counts an open of oid, returns true if it should be materialized now
+	bool wanted(const git_oid & oid, off_t size);
+
+	// Stores oid on a thread of the store, once however often it is asked
+	// for meanwhile; opens keep reading from the pack until it is stored
+	void storeLater(const git_oid & oid, off_t size, SourceFunction source);
+	// Drops what is queued and waits for the store in progress
+	void stop();
+
+private:
+	ObjectStore();
+	~ObjectStore();
+
+	std::string pathOf(const git_oid & oid) const;
+	bool store(const git_oid & oid, off_t size, const ReadFunction & read);
+	void touch(int fd) const;
+	void trim();
+	void run();
+
+	std::string mDirectory;
+	off_t mSizeThreshold;
+	unsigned int mOpenThreshold;
+	ShardedMap<git_oid, unsigned int, GitOidHash> mOpens;
+
+	// Estimate between trims, which recount what all mounts stored
+	uint64_t mLimit;
+	// Stored bytes as of the last scan plus what was stored since, only
+	// used by the store's thread
+	uint64_t mBytes;
+
+	struct Pending
+	{
+		git_oid oid;
+		off_t size;
+		SourceFunction source;
+	};
+
+	std::mutex mQueueLock;
+	std::condition_variable mQueueWake;
+	std::deque<Pending> mQueue;
+	std::unordered_set<git_oid, GitOidHash> mQueued;
+	bool mStopping;
+	std::thread mThread;
+};
+
+#endif // OBJECT_STORE_H_
@@ -0,0 +1,273 @@
+#include "pack_index.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <dirent.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr unsigned char IdxMagic[4] = { 0xff, 't', 'O', 'c' };
+constexpr size_t IdxHeaderSize = 8;
+constexpr size_t IdxFanoutSize = 256 * 4;
+constexpr size_t OidSize = sizeof(git_oid::id);
+
+inline uint32_t readBE32(const unsigned char * ptr)
+{
+	uint32_t value;
+	std::memcpy(&value, ptr, sizeof(value));
+	return be32toh(value);
+}
+
+inline uint64_t readBE64(const unsigned char * ptr)
+{
+	uint64_t value;
+	std::memcpy(&value, ptr, sizeof(value));
+	return be64toh(value);
+}
+
+bool sameTime(const struct timespec & lhs, const struct timespec & rhs)
+{
+	return lhs.tv_sec == rhs.tv_sec && lhs.tv_nsec == rhs.tv_nsec;
+}
+
+} // namespace
+
+PackIndex::PackFile::PackFile(std::string path) : mPath(std::move(path)), mFd(-1), mIdx(nullptr), mIdxSize(0), mCount(0)
+{
+}
+
+PackIndex::PackFile::~PackFile()
+{
+	if (mIdx)
+		munmap(const_cast<unsigned char *>(mIdx), mIdxSize);
+	if (mFd >= 0)
+		close(mFd);
+}
+
+bool PackIndex::PackFile::open()
+{
+	std::string idxPath = mPath.substr(0, mPath.size() - 5) + ".idx";
+
+	int idxFd = ::open(idxPath.c_str(), O_RDONLY | O_CLOEXEC);
+	if (idxFd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(idxFd, &st) != 0 || size_t(st.st_size) < IdxHeaderSize + IdxFanoutSize + 2 * OidSize)
+	{
+		close(idxFd);
+		return false;
+	}
+
+	void * idx = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, idxFd, 0);
+	close(idxFd);
+	if (idx == MAP_FAILED)
+		return false;
+
+	mIdx = reinterpret_cast<const unsigned char *>(idx);
+	mIdxSize = st.st_size;
+
+	// Only version 2 indexes are supported, version 1 has been obsolete for ages
+	if (std::memcmp(mIdx, IdxMagic, sizeof(IdxMagic)) != 0 || readBE32(mIdx + 4) != 2)
+		return false;
+
+	mCount = readBE32(mIdx + IdxHeaderSize + 255 * 4);
+	size_t needed = IdxHeaderSize + IdxFanoutSize + size_t(mCount) * (OidSize + 4 + 4) + 2 * OidSize;
+	if (mIdxSize < needed)
+		return false;
+
+	mFd = ::open(mPath.c_str(), O_RDONLY | O_CLOEXEC);
+	return mFd >= 0;
+}
+
+bool PackIndex::PackFile::find(const git_oid & oid, uint64_t & offset) const
+{
+	const unsigned char * fanout = mIdx + IdxHeaderSize;
+	const unsigned char * oids = fanout + IdxFanoutSize;
+
+	uint8_t first = oid.id[0];
+	uint32_t lo = (first == 0 ? 0 : readBE32(fanout + (first - 1) * 4));
+	uint32_t hi = readBE32(fanout + first * 4);
+
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = std::memcmp(oids + size_t(mid) * OidSize, oid.id, OidSize);
+		if (cmp == 0)
+		{
+			const unsigned char * offsets = oids + size_t(mCount) * (OidSize + 4);
+			uint32_t small = readBE32(offsets + size_t(mid) * 4);
+			if (small & 0x80000000)
+			{
+				const unsigned char * large = offsets + size_t(mCount) * 4 + size_t(small & 0x7fffffff) * 8;
+				if (large + 8 > mIdx + mIdxSize)
+					return false;
+				offset = readBE64(large);
+			}
+			else
+			{
+				offset = small;
+			}
+			return true;
+		}
+
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return false;
+}
+
+PackIndex & PackIndex::forRepository(const GitRepositoryView & repo)
+{
+	static std::mutex registryLock;
+	static std::map<std::string, std::unique_ptr<PackIndex>> registry;
+
+	std::string objectsDir = repo.commonDir();
+	objectsDir += "objects";
+
+	std::lock_guard<std::mutex> guard(registryLock);
+	auto & index = registry[objectsDir];
+	if (!index)
+		index.reset(new PackIndex(objectsDir));
+	return *index;
+}
+
+PackIndex::PackIndex(std::string objectsDir) : mObjectsDir(std::move(objectsDir)), mPackDirTime{}
+{
+	std::lock_guard<std::mutex> guard(mLock);
+	rescan();
+}
+
+void PackIndex::rescan()
+{
+	// Caller holds mLock
+	std::string packDir = mObjectsDir + "/pack";
+
+	struct stat st;
+	if (stat(packDir.c_str(), &st) != 0)
+		return;
+
+	if (sameTime(st.st_mtim, mPackDirTime) && !mPacks.empty())
+		return;
+
+	mPackDirTime = st.st_mtim;
+
+	DIR * dir = opendir(packDir.c_str());
+	if (!dir)
+		return;
+
+	std::vector<PackFilePtr> packs;
+	while (struct dirent * entry = readdir(dir))
+	{
+		std::string_view name(entry->d_name);
+		if (name.size() < 6 || name.substr(name.size() - 5) != ".pack")
+			continue;
+
+		std::string path = packDir + '/' + entry->d_name;
+		auto existing = std::find_if(mPacks.begin(), mPacks.end(), [&path] (const PackFilePtr & pack) { return pack->path() == path; });
+		if (existing != mPacks.end())
+		{
+			packs.push_back(*existing);
+			continue;
+		}
+
+		std::shared_ptr<PackFile> pack(new PackFile(std::move(path)));
+		if (pack->open())
+			packs.push_back(std::move(pack));
+	}
+	closedir(dir);
+
+	// Big packs first, that's where most objects live
+	std::sort(packs.begin(), packs.end(), [] (const PackFilePtr & lhs, const PackFilePtr & rhs) { return lhs->objectCount() > rhs->objectCount(); });
+	mPacks.swap(packs);
+}
+
+bool PackIndex::find(const git_oid & oid, Location & location)
+{
+	for (int attempt = 0; attempt < 2; ++attempt)
+	{
+		std::vector<PackFilePtr> packs;
+		{
+			std::lock_guard<std::mutex> guard(mLock);
+			if (attempt > 0)
+				rescan();
+			packs = mPacks;
+		}
+
+		for (const PackFilePtr & pack : packs)
+		{
+			if (pack->find(oid, location.offset))
+			{
+				location.pack = pack;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+bool PackIndex::openStream(const git_oid & oid, git_object_t type, Stream & stream)
+{
+	Location location;
+	if (find(oid, location))
+	{
+		unsigned char header[32];
+		ssize_t got = pread(location.pack->fd(), header, sizeof(header), location.offset);
+		if (got <= 0)
+			return false;
+
+		// Type and size are encoded in a little endian base-128 varint
+		size_t pos = 0;
+		unsigned char byte = header[pos++];
+		int objectType = (byte >> 4) & 7;
+		uint64_t size = byte & 15;
+		int shift = 4;
+		while ((byte & 0x80) && pos < size_t(got))
+		{
+			byte = header[pos++];
+			size |= uint64_t(byte & 0x7f) << shift;
+			shift += 7;
+		}
+
+		// Deltified objects can't be streamed without their base
+		if (objectType != type || (byte & 0x80))
+			return false;
+
+		stream.pack = location.pack;
+		stream.fd = location.pack->fd();
+		stream.start = location.offset + pos;
+		stream.size = size;
+		stream.loose = false;
+		return true;
+	}
+
+	char hex[GIT_OID_HEXSZ + 1];
+	git_oid_tostr(hex, sizeof(hex), &oid);
+
+	std::string path = mObjectsDir;
+	path += '/';
+	path.append(hex, 2);
+	path += '/';
+	path.append(hex + 2);
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	stream.pack.reset();
+	stream.fd = fd;
+	stream.start = 0;
+	stream.size = 0;
+	stream.loose = true;
+	return true;
+}
@@ -0,0 +1,81 @@
+#ifndef PACK_INDEX_H_
+#define PACK_INDEX_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "git_wrappers.h"
+
+/*
+ * Read-only view of the version 2 pack indexes of a repository, used to find
+ * where an object is stored without going through libgit2. libgit2 does not
+ * expose pack positions, but knowing them allows streaming an undeltified
+ * object straight from its zlib data.
+ */
+class PackIndex
+{
+public:
+	class PackFile
+	{
+	public:
+		PackFile(const PackFile & other) = delete;
+		~PackFile();
+
+		inline int fd() const { return mFd; }
+		inline const std::string & path() const { return mPath; }
+		inline uint32_t objectCount() const { return mCount; }
+
+		bool find(const git_oid & oid, uint64_t & offset) const;
+
+	private:
+		friend class PackIndex;
+		PackFile(std::string path);
+		bool open();
+
+		std::string mPath;
+		int mFd;
+		const unsigned char * mIdx;
+		size_t mIdxSize;
+		uint32_t mCount;
+	};
+
+	using PackFilePtr = std::shared_ptr<const PackFile>;
+
+	struct Location
+	{
+		PackFilePtr pack;
+		uint64_t offset;
+	};
+
+	// Raw zlib stream of an object that is stored as a whole
+	struct Stream
+	{
+		PackFilePtr pack;     // Keeps the descriptor alive for packed objects
+		int fd;               // Owned by the caller for loose objects
+		uint64_t start;       // Offset of the zlib header
+		uint64_t size;        // Inflated size of the object
+		bool loose;           // Loose objects are prefixed by "<type> <size>\0"
+	};
+
+public:
+	static PackIndex & forRepository(const GitRepositoryView & repo);
+
+	bool find(const git_oid & oid, Location & location);
+	bool openStream(const git_oid & oid, git_object_t type, Stream & stream);
+
+	inline const std::string & objectsDir() const { return mObjectsDir; }
+
+private:
+	PackIndex(std::string objectsDir);
+	void rescan();
+
+	std::string mObjectsDir;
+	std::mutex mLock;
+	std::vector<PackFilePtr> mPacks;
+	struct timespec mPackDirTime;
+};
+
+#endif // PACK_INDEX_H_
@@ -0,0 +1,263 @@
+#include "prefetcher.h"
+#include "batch_loader.h"
+#include "blob_cache.h"
+#include "repository_pool.h"
+#include <algorithm>
+
+namespace
+{
+
+// Directories a process must list in a row before it counts as walking
+constexpr unsigned int WalkThreshold = 2;
+// Levels of subtrees decoded below a directory that is listed
+constexpr unsigned int TreeDepth = 2;
+// Files a process must open in listing order before blobs are prefetched
+constexpr unsigned int SequentialThreshold = 2;
+// Files inflated ahead of the last one opened
+constexpr size_t BlobWindow = 16;
+// Queued tasks beyond which new prefetches are dropped
+constexpr size_t MaxPending = 4096;
+// Streams idle this long are forgotten once there are many
+constexpr auto StreamIdle = std::chrono::seconds(10);
+constexpr size_t MaxStreams = 256;
+
+} // namespace
+
+Prefetcher::Prefetcher(size_t threads, size_t budget) : mBudget(budget), mInflight(0), mPool(threads)
+{
+}
+
+Prefetcher::~Prefetcher()
+{
+	std::lock_guard<std::mutex> guard(mLock);
+	for (auto & iter : mStreams)
+	{
+		cancel(iter.second.walk);
+		cancel(iter.second.blobs);
+	}
+}
+
+Prefetcher::Token Prefetcher::newToken()
+{
+	return std::make_shared<std::atomic<bool>>(false);
+}
+
+void Prefetcher::cancel(Token & token)
+{
+	if (token)
+		token->store(true, std::memory_order_relaxed);
+	token = newToken();
+}
+
+Prefetcher::Stream & Prefetcher::streamFor(pid_t pid)
+{
+	Clock::time_point now = Clock::now();
+
+	if (mStreams.size() >= MaxStreams && !mStreams.count(pid))
+	{
+		for (auto iter = mStreams.begin(); iter != mStreams.end(); )
+		{
+			if (now - iter->second.lastSeen < StreamIdle)
+			{
+				++iter;
+				continue;
+			}
+
+			cancel(iter->second.walk);
+			cancel(iter->second.blobs);
+			iter = mStreams.erase(iter);
+		}
+	}
+
+	Stream & stream = mStreams[pid];
+	stream.lastSeen = now;
+	if (!stream.walk)
+		stream.walk = newToken();
+	if (!stream.blobs)
+		stream.blobs = newToken();
+	return stream;
+}
+
+void Prefetcher::listed(pid_t pid, const GitRepositoryView & repo, const std::shared_ptr<const TreeNode> & tree)
+{
+	if (!tree)
+		return;
+
+	Token token;
+	{
+		std::lock_guard<std::mutex> guard(mLock);
+		Stream & stream = streamFor(pid);
+		if (stream.walkLength > 0 && stream.lastListed == tree->id())
+			return;
+
+		stream.lastListed = tree->id();
+		if (++stream.walkLength < WalkThreshold)
+			return;
+
+		token = stream.walk;
+	}
+
+	std::vector<git_oid> subtrees = subtreesOf(*tree);
+	if (!subtrees.empty())
+		mPool.submit([this, repo, subtrees = std::move(subtrees), token] { prefetchTrees(repo, subtrees, TreeDepth, token); });
+}
+
+void Prefetcher::opened(pid_t pid, const GitRepositoryView & repo, const std::shared_ptr<const TreeNode> & parent, const git_oid & oid)
+{
+	if (!parent || parent->count() == 0)
+		return;
+
+	Token token;
+	size_t from, to;
+	{
+		std::lock_guard<std::mutex> guard(mLock);
+		Stream & stream = streamFor(pid);
+		if (stream.files != parent)
+		{
+			cancel(stream.blobs);
+			stream.files = parent;
+			stream.lastIndex = TreeNode::npos;
+			stream.prefetchedUpTo = 0;
+			stream.sequential = 0;
+		}
+
+		// Walkers open files in listing order, so look right after the last one first
+		size_t count = parent->count();
+		size_t start = (stream.lastIndex == TreeNode::npos ? 0 : stream.lastIndex + 1);
+		size_t index = TreeNode::npos;
+		for (size_t i = 0; i < count && index == TreeNode::npos; ++i)
+		{
+			size_t candidate = (start + i) % count;
+			if (parent->entry(candidate).oid == oid)
+				index = candidate;
+		}
+		if (index == TreeNode::npos)
+			return;
+
+		if (stream.lastIndex != TreeNode::npos && index > stream.lastIndex)
+			++stream.sequential;
+		else if (stream.lastIndex != TreeNode::npos)
+			stream.sequential = 0;
+		stream.lastIndex = index;
+
+		if (stream.sequential < SequentialThreshold && !stream.wholeReads)
+			return;
+
+		from = std::max(index + 1, stream.prefetchedUpTo);
+		to = std::min(count, index + 1 + BlobWindow);
+		if (from >= to)
+			return;
+
+		stream.prefetchedUpTo = to;
+		token = stream.blobs;
+	}
+
+	std::vector<Blob> blobs;
+	for (size_t i = from; i < to; ++i)
+	{
+		const TreeNode::Entry & entry = parent->entry(i);
+		if (entry.mode != GIT_FILEMODE_BLOB && entry.mode != GIT_FILEMODE_BLOB_EXECUTABLE)
+			continue;
+
+		off_t size = parent->size(i);
+		if (size > BlobCache::SmallBlob || !reserve(size))
+			continue;
+
+		blobs.push_back(Blob{ entry.oid, size_t(size) });
+	}
+
+	if (!blobs.empty())
+		mPool.submit([this, repo, blobs = std::move(blobs), token] { prefetchBlobs(repo, blobs, token); });
+}
+
+void Prefetcher::readWhole(pid_t pid)
+{
+	std::lock_guard<std::mutex> guard(mLock);
+	streamFor(pid).wholeReads = true;
+}
+
+std::vector<git_oid> Prefetcher::subtreesOf(const TreeNode & tree)
+{
+	std::vector<git_oid> subtrees;
+	for (size_t i = 0; i < tree.count(); ++i)
+	{
+		if (tree.entry(i).mode == GIT_FILEMODE_TREE)
+			subtrees.push_back(tree.entry(i).oid);
+	}
+	return subtrees;
+}
+
+void Prefetcher::prefetchTrees(const GitRepositoryView & repo, const std::vector<git_oid> & oids, unsigned int depth, const Token & token)
+{
+	if (token->load(std::memory_order_relaxed) || mPool.pending() > MaxPending)
+		return;
+
+	BatchLoader batch(repo);
+	for (const git_oid & oid : oids)
+		batch.add(oid);
+
+	// Sibling trees are decoded in pack order, each level below as a batch of its own
+	batch.run([&] (size_t, const git_oid & oid)
+	{
+		if (token->load(std::memory_order_relaxed))
+			return false;
+
+		std::shared_ptr<const TreeNode> node = TreeNode::get(repo, &oid);
+		if (!node)
+			return true;
+
+		// Listing resolves the sizes of all blobs as well
+		node->dirents();
+
+		std::vector<git_oid> subtrees;
+		if (depth > 1)
+			subtrees = subtreesOf(*node);
+		if (!subtrees.empty())
+			mPool.submit([this, repo, subtrees = std::move(subtrees), depth, token] { prefetchTrees(repo, subtrees, depth - 1, token); });
+		return true;
+	});
+}
+
+void Prefetcher::prefetchBlobs(const GitRepositoryView & repo, const std::vector<Blob> & blobs, const Token & token)
+{
+	BatchLoader batch(repo);
+	for (const Blob & blob : blobs)
+		batch.add(blob.oid);
+
+	// The pins are dropped right away, the contents stay cached until evicted
+	std::vector<bool> done(blobs.size(), false);
+	batch.run([&] (size_t index, const git_oid & oid)
+	{
+		if (token->load(std::memory_order_relaxed))
+			return false;
+
+		BlobCache::instance().get(RepositoryPool::local(repo), &oid);
+		release(blobs[index].size);
+		done[index] = true;
+		return true;
+	});
+
+	for (size_t i = 0; i < blobs.size(); ++i)
+	{
+		if (!done[i])
+			release(blobs[i].size);
+	}
+}
+
+bool Prefetcher::reserve(size_t bytes)
+{
+	size_t inflight = mInflight.load(std::memory_order_relaxed);
+	do
+	{
+		if (inflight + bytes > mBudget || mPool.pending() > MaxPending)
+			return false;
+	}
+	while (!mInflight.compare_exchange_weak(inflight, inflight + bytes, std::memory_order_relaxed));
+
+	return true;
+}
+
+void Prefetcher::release(size_t bytes)
+{
+	mInflight.fetch_sub(bytes, std::memory_order_relaxed);
+}
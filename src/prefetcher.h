@@ -0,0 +1,89 @@
+#ifndef PREFETCHER_H_
+#define PREFETCHER_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+#include "git_wrappers.h"
+#include "tree_node.h"
+#include "work_stealing_pool.h"
+
+/*
+ * Guesses what a process is going to touch next from how it walks the
+ * mount and warms that up on a pool of its own. A process that lists one
+ * directory after another gets the subtrees of what it lists decoded and
+ * sized ahead; a process that opens the files of a directory in listing
+ * order, or reads its files whole, gets the next small blobs inflated into
+ * the blob cache. Prefetching for a stream is cancelled once the process
+ * moves elsewhere, and blob prefetches in flight are limited to a budget.
+ */
+class Prefetcher
+{
+public:
+	Prefetcher(size_t threads, size_t budget);
+	Prefetcher(const Prefetcher & other) = delete;
+	~Prefetcher();
+
+	// Process pid listed the directory tree
+	void listed(pid_t pid, const GitRepositoryView & repo, const std::shared_ptr<const TreeNode> & tree);
+	// Process pid opened blob oid of the directory parent
+	void opened(pid_t pid, const GitRepositoryView & repo, const std::shared_ptr<const TreeNode> & parent, const git_oid & oid);
+	// Process pid read a file from start to end in order
+	void readWhole(pid_t pid);
+
+private:
+	using Clock = std::chrono::steady_clock;
+	using Token = std::shared_ptr<std::atomic<bool>>;
+
+	struct Stream
+	{
+		Clock::time_point lastSeen;
+
+		// Directories listed one after another
+		git_oid lastListed;
+		unsigned int walkLength = 0;
+		Token walk;
+
+		// Files opened from a single directory
+		std::shared_ptr<const TreeNode> files;
+		size_t lastIndex = TreeNode::npos;
+		size_t prefetchedUpTo = 0;
+		unsigned int sequential = 0;
+		bool wholeReads = false;
+		Token blobs;
+	};
+
+	Stream & streamFor(pid_t pid);
+	static Token newToken();
+	static void cancel(Token & token);
+
+	struct Blob
+	{
+		git_oid oid;
+		size_t size;
+	};
+
+	static std::vector<git_oid> subtreesOf(const TreeNode & tree);
+
+	// Both load their objects in pack order
+	void prefetchTrees(const GitRepositoryView & repo, const std::vector<git_oid> & oids, unsigned int depth, const Token & token);
+	void prefetchBlobs(const GitRepositoryView & repo, const std::vector<Blob> & blobs, const Token & token);
+
+	bool reserve(size_t bytes);
+	void release(size_t bytes);
+
+	size_t mBudget;
+	std::atomic<size_t> mInflight;
+
+	std::mutex mLock;
+	std::unordered_map<pid_t, Stream> mStreams;
+
+	// Last, so its threads are gone before anything they use
+	WorkStealingPool mPool;
+};
+
+#endif // PREFETCHER_H_
@@ -0,0 +1,252 @@
+#include "ref_index.h"
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr int MaxSymbolicDepth = 5;
+
+struct LoadedRef
+{
+	std::string name;
+	std::string symbolic;
+	git_oid target;
+	git_oid peeled;
+	bool hasPeeled;
+	bool loose;
+};
+
+inline std::string_view trimmed(std::string_view line)
+{
+	while (!line.empty() && (line.back() == '\n' || line.back() == '\r' || line.back() == ' '))
+		line.remove_suffix(1);
+	return line;
+}
+
+bool parseOid(git_oid * oid, std::string_view hex)
+{
+	return hex.size() == GIT_OID_HEXSZ && git_oid_fromstrn(oid, hex.data(), hex.size()) == 0;
+}
+
+void readPackedRefs(const std::string & path, std::vector<LoadedRef> & refs)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	void * map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	std::string_view content(reinterpret_cast<const char *>(map), st.st_size);
+	while (!content.empty())
+	{
+		auto eol = content.find('\n');
+		std::string_view line = trimmed(content.substr(0, eol));
+		content = (eol == content.npos ? std::string_view() : content.substr(eol + 1));
+
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		// "^<oid>" is what the annotated tag on the line before peels to
+		if (line[0] == '^')
+		{
+			if (!refs.empty() && parseOid(&refs.back().peeled, line.substr(1)))
+				refs.back().hasPeeled = true;
+			continue;
+		}
+
+		LoadedRef ref = {};
+		if (line.size() > GIT_OID_HEXSZ + 1 && line[GIT_OID_HEXSZ] == ' ' && parseOid(&ref.target, line.substr(0, GIT_OID_HEXSZ)))
+		{
+			ref.name = std::string(line.substr(GIT_OID_HEXSZ + 1));
+			refs.push_back(std::move(ref));
+		}
+	}
+
+	munmap(map, st.st_size);
+}
+
+void readLooseRefs(const std::string & path, const std::string & name, std::vector<LoadedRef> & refs)
+{
+	DIR * dir = opendir(path.c_str());
+	if (!dir)
+		return;
+
+	while (struct dirent * entry = readdir(dir))
+	{
+		std::string_view child(entry->d_name);
+		if (child == "." || child == ".." || (child.size() >= 5 && child.substr(child.size() - 5) == ".lock"))
+			continue;
+
+		std::string childPath = path + '/' + entry->d_name;
+		std::string childName = name + '/' + entry->d_name;
+
+		struct stat st;
+		bool isDir = (entry->d_type == DT_DIR);
+		if (entry->d_type == DT_UNKNOWN)
+			isDir = (lstat(childPath.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+
+		if (isDir)
+		{
+			readLooseRefs(childPath, childName, refs);
+			continue;
+		}
+
+		int fd = ::open(childPath.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		char buffer[512];
+		ssize_t got = ::read(fd, buffer, sizeof(buffer));
+		close(fd);
+		if (got <= 0)
+			continue;
+
+		std::string_view content = trimmed(std::string_view(buffer, got));
+		LoadedRef ref = {};
+		ref.name = std::move(childName);
+		ref.loose = true;
+		if (content.substr(0, 5) == "ref: ")
+			ref.symbolic = std::string(content.substr(5));
+		else if (!parseOid(&ref.target, content))
+			continue;
+
+		refs.push_back(std::move(ref));
+	}
+
+	closedir(dir);
+}
+
+} // namespace
+
+std::shared_ptr<const RefIndex> RefIndex::load(const std::string & commonDir)
+{
+	std::string base(commonDir);
+	while (base.size() > 1 && base.back() == '/')
+		base.pop_back();
+
+	std::vector<LoadedRef> refs;
+	readPackedRefs(base + "/packed-refs", refs);
+	readLooseRefs(base + "/refs", "refs", refs);
+
+	// Loose refs sort after the packed ones of the same name and win
+	std::stable_sort(refs.begin(), refs.end(), [] (const LoadedRef & lhs, const LoadedRef & rhs)
+	{
+		return lhs.name < rhs.name;
+	});
+
+	std::vector<LoadedRef> unique;
+	unique.reserve(refs.size());
+	for (auto & ref : refs)
+	{
+		if (!unique.empty() && unique.back().name == ref.name)
+		{
+			// A loose copy of a packed ref still peels the same way
+			LoadedRef & packed = unique.back();
+			if (ref.symbolic.empty() && packed.target == ref.target && packed.hasPeeled)
+			{
+				ref.peeled = packed.peeled;
+				ref.hasPeeled = true;
+			}
+			packed = std::move(ref);
+		}
+		else
+		{
+			unique.push_back(std::move(ref));
+		}
+	}
+	refs.clear();
+
+	auto byName = [&unique] (const std::string & name) -> LoadedRef *
+	{
+		auto iter = std::lower_bound(unique.begin(), unique.end(), name, [] (const LoadedRef & ref, const std::string & name)
+		{
+			return ref.name < name;
+		});
+		return (iter != unique.end() && iter->name == name ? &*iter : nullptr);
+	};
+
+	auto index = std::make_shared<RefIndex>();
+	size_t nameBytes = 0;
+	for (const auto & ref : unique)
+		nameBytes += ref.name.size();
+	index->mNames.reserve(nameBytes);
+	index->mRefs.reserve(unique.size());
+
+	for (const auto & ref : unique)
+	{
+		// Symbolic refs take the target of what they point at, dangling ones are left out
+		const LoadedRef * resolved = &ref;
+		for (int depth = 0; resolved && !resolved->symbolic.empty() && depth < MaxSymbolicDepth; ++depth)
+			resolved = byName(resolved->symbolic);
+		if (!resolved || !resolved->symbolic.empty())
+			continue;
+
+		Ref entry;
+		entry.nameOffset = uint32_t(index->mNames.size());
+		entry.nameLength = uint32_t(ref.name.size());
+		entry.target = resolved->target;
+		entry.peeled = resolved->peeled;
+		entry.hasPeeled = resolved->hasPeeled;
+		index->mNames += ref.name;
+		index->mRefs.push_back(entry);
+	}
+
+	return index;
+}
+
+RefIndex::RefIndex()
+{
+}
+
+RefIndex::~RefIndex()
+{
+}
+
+size_t RefIndex::lowerBound(std::string_view prefix) const
+{
+	size_t low = 0, high = mRefs.size();
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (name(mid) < prefix)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+size_t RefIndex::prefixEnd(size_t from, std::string_view prefix) const
+{
+	// Names starting with prefix are contiguous from the lower bound on
+	size_t low = from, high = mRefs.size();
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (name(mid).substr(0, prefix.size()) == prefix)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+size_t RefIndex::find(std::string_view refname) const
+{
+	size_t index = lowerBound(refname);
+	return (index < mRefs.size() && name(index) == refname ? index : npos);
+}
@@ -0,0 +1,60 @@
+#ifndef REF_INDEX_H_
+#define REF_INDEX_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "git_wrappers.h"
+
+/*
+ * Immutable, sorted table of every ref of a repository and the object it
+ * points at, read straight from packed-refs with the loose refs laid over
+ * it. Names live in one shared buffer, so even hundreds of thousands of refs
+ * take a few tens of bytes each. Symbolic refs are resolved while loading.
+ * The pseudo directories of the refs are built from ranges of this table
+ * when they are first used, nothing is resolved up front.
+ */
+class RefIndex
+{
+public:
+	static constexpr size_t npos = size_t(-1);
+
+public:
+	// Reads the refs below the common directory of a repository
+	static std::shared_ptr<const RefIndex> load(const std::string & commonDir);
+
+	RefIndex();
+	RefIndex(const RefIndex & other) = delete;
+	~RefIndex();
+
+	inline size_t size() const { return mRefs.size(); }
+	inline std::string_view name(size_t index) const { return std::string_view(mNames.data() + mRefs[index].nameOffset, mRefs[index].nameLength); }
+	inline const git_oid & target(size_t index) const { return mRefs[index].target; }
+
+	// Commit or other object an annotated tag peels to, if packed-refs knows
+	inline const git_oid * peeled(size_t index) const { return (mRefs[index].hasPeeled ? &mRefs[index].peeled : nullptr); }
+
+	// First ref not sorting before prefix
+	size_t lowerBound(std::string_view prefix) const;
+	// First ref at or after from that doesn't start with prefix
+	size_t prefixEnd(size_t from, std::string_view prefix) const;
+
+	size_t find(std::string_view name) const;
+
+private:
+	struct Ref
+	{
+		uint32_t nameOffset;
+		uint32_t nameLength;
+		git_oid target;
+		git_oid peeled;
+		bool hasPeeled;
+	};
+
+	std::string mNames;
+	std::vector<Ref> mRefs;
+};
+
+#endif // REF_INDEX_H_
@@ -0,0 +1,234 @@
+#include "ref_watcher.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <string_view>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr uint32_t FileEvents = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE;
+
+std::string withoutSlash(std::string path)
+{
+	while (path.size() > 1 && path.back() == '/')
+		path.pop_back();
+	return path;
+}
+
+bool isLockFile(std::string_view name)
+{
+	return name.size() >= 5 && name.substr(name.size() - 5) == ".lock";
+}
+
+} // namespace
+
+RefWatcher::RefWatcher(Callback callback) : mCallback(std::move(callback)), mInotify(-1), mWakeup(-1), mGitDirWatch(-1), mCommonDirWatch(-1)
+{
+}
+
+RefWatcher::~RefWatcher()
+{
+	stop();
+}
+
+bool RefWatcher::start(const std::string & gitDir, const std::string & commonDir)
+{
+	if (mThread.joinable())
+		return true;
+
+	mInotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	mWakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mInotify < 0 || mWakeup < 0)
+	{
+		stop();
+		return false;
+	}
+
+	std::string common = withoutSlash(commonDir.empty() ? gitDir : commonDir);
+	mGitDirWatch = inotify_add_watch(mInotify, withoutSlash(gitDir).c_str(), FileEvents | IN_ONLYDIR);
+	mCommonDirWatch = inotify_add_watch(mInotify, common.c_str(), FileEvents | IN_ONLYDIR);
+	if (mGitDirWatch < 0 || mCommonDirWatch < 0)
+	{
+		stop();
+		return false;
+	}
+
+	mRefsDir = common + "/refs";
+	watchTree(mRefsDir);
+
+	mThread = std::thread(&RefWatcher::run, this);
+	return true;
+}
+
+void RefWatcher::stop()
+{
+	if (mThread.joinable())
+	{
+		uint64_t one = 1;
+		if (write(mWakeup, &one, sizeof(one)) == sizeof(one))
+			mThread.join();
+		else
+			mThread.detach();
+	}
+
+	if (mInotify >= 0)
+		close(mInotify);
+	if (mWakeup >= 0)
+		close(mWakeup);
+
+	mInotify = -1;
+	mWakeup = -1;
+	mGitDirWatch = -1;
+	mCommonDirWatch = -1;
+	mDirectories.clear();
+}
+
+void RefWatcher::watchTree(const std::string & path)
+{
+	int wd = inotify_add_watch(mInotify, path.c_str(), FileEvents | IN_ONLYDIR);
+	if (wd < 0)
+		return;
+
+	mDirectories[wd] = path;
+
+	// Refs created before the watch was in place are picked up by the
+	// rebuild the caller triggers anyway, only the directories matter here
+	DIR * dir = opendir(path.c_str());
+	if (!dir)
+		return;
+
+	while (struct dirent * entry = readdir(dir))
+	{
+		std::string_view name(entry->d_name);
+		if (name == "." || name == "..")
+			continue;
+
+		std::string child = path + '/' + entry->d_name;
+		bool isDir = (entry->d_type == DT_DIR);
+		if (entry->d_type == DT_UNKNOWN)
+		{
+			struct stat st;
+			isDir = (lstat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+		}
+
+		if (isDir)
+			watchTree(child);
+	}
+
+	closedir(dir);
+}
+
+bool RefWatcher::readEvents()
+{
+	alignas(struct inotify_event) char buffer[16384];
+	bool relevant = false;
+
+	while (true)
+	{
+		ssize_t got = read(mInotify, buffer, sizeof(buffer));
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			break;
+
+		for (char * ptr = buffer; ptr < buffer + got; )
+		{
+			const struct inotify_event * event = reinterpret_cast<const struct inotify_event *>(ptr);
+			ptr += sizeof(struct inotify_event) + event->len;
+
+			std::string_view name(event->len ? event->name : "");
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				// Directories may have been created unseen, watching is idempotent
+				watchTree(mRefsDir);
+				relevant = true;
+				continue;
+			}
+
+			if (event->wd == mGitDirWatch || event->wd == mCommonDirWatch)
+			{
+				if (name == "HEAD" || name == "packed-refs")
+					relevant = true;
+				else if (name == "refs" && (event->mask & IN_ISDIR))
+				{
+					watchTree(mRefsDir);
+					relevant = true;
+				}
+				continue;
+			}
+
+			auto iter = mDirectories.find(event->wd);
+			if (iter == mDirectories.end())
+				continue;
+
+			if (event->mask & IN_IGNORED)
+			{
+				mDirectories.erase(iter);
+				relevant = true;
+				continue;
+			}
+
+			if (name.empty() || isLockFile(name))
+				continue;
+
+			if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+				watchTree(iter->second + '/' + std::string(name));
+			relevant = true;
+		}
+	}
+
+	return relevant;
+}
+
+void RefWatcher::run()
+{
+	using Clock = std::chrono::steady_clock;
+
+	bool pending = false;
+	Clock::time_point first;
+
+	while (true)
+	{
+		int timeout = -1;
+		if (pending)
+		{
+			auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - first).count();
+			timeout = std::max<int>(0, std::min<int>(QuietMs, MaxDelayMs - waited));
+		}
+
+		struct pollfd fds[2] = { { mInotify, POLLIN, 0 }, { mWakeup, POLLIN, 0 } };
+		int ready = poll(fds, 2, timeout);
+		if (ready < 0 && errno == EINTR)
+			continue;
+		if (ready < 0 || (fds[1].revents & POLLIN))
+			break;
+
+		if ((fds[0].revents & POLLIN) && readEvents() && !pending)
+		{
+			pending = true;
+			first = Clock::now();
+		}
+
+		// Wait for the burst to calm down, but not forever
+		if (!pending || (ready > 0 && Clock::now() - first < std::chrono::milliseconds(MaxDelayMs)))
+			continue;
+
+		pending = false;
+		try
+		{
+			mCallback();
+		}
+		catch (...)
+		{
+			std::cerr << "Failed to refresh the refs" << std::endl;
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef REF_WATCHER_H_
+#define REF_WATCHER_H_
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+/*
+ * Watches the refs of a repository with inotify: HEAD in the git directory,
+ * packed-refs and every directory below refs/ in the common directory. Git
+ * updates a ref by renaming a lock file over it, so lock files are ignored
+ * and a burst of updates (a fetch, a rebase) is debounced into one call of
+ * the callback, made on the thread of the watcher.
+ */
+class RefWatcher
+{
+public:
+	using Callback = std::function<void()>;
+
+public:
+	RefWatcher(Callback callback);
+	RefWatcher(const RefWatcher & other) = delete;
+	~RefWatcher();
+
+	bool start(const std::string & gitDir, const std::string & commonDir);
+	void stop();
+
+private:
+	void run();
+	bool readEvents();
+	void watchTree(const std::string & path);
+
+	static constexpr int QuietMs = 100;
+	static constexpr int MaxDelayMs = 1000;
+
+	Callback mCallback;
+	int mInotify;
+	int mWakeup;
+	int mGitDirWatch;
+	int mCommonDirWatch;
+	std::string mRefsDir;
+	std::unordered_map<int, std::string> mDirectories;
+	std::thread mThread;
+};
+
+#endif // REF_WATCHER_H_
@@ -0,0 +1,100 @@
+#include "repository_pool.h"
+#include <git2.h>
+
+std::atomic<RepositoryPool *> RepositoryPool::gPool(nullptr);
+
+namespace
+{
+
+struct LocalHandle
+{
+	const RepositoryPool * pool = nullptr;
+	size_t slot = 0;
+	const git_repository * primary = nullptr;
+	git_repository * handle = nullptr;
+};
+
+thread_local LocalHandle tLocal;
+
+} // namespace
+
+RepositoryPool::RepositoryPool(const GitRepositoryView & primary, size_t handles) : mPrimary(primary), mCount(handles ? handles : 1), mNextSlot(0)
+{
+	const char * path = (primary ? git_repository_path(primary) : nullptr);
+	if (path)
+		mPath = path;
+
+	mHandles.reset(new std::atomic<git_repository *>[mCount]);
+	for (size_t i = 0; i < mCount; ++i)
+		mHandles[i].store(nullptr, std::memory_order_relaxed);
+
+	gPool.store(this, std::memory_order_release);
+}
+
+RepositoryPool::~RepositoryPool()
+{
+	RepositoryPool * self = this;
+	gPool.compare_exchange_strong(self, nullptr);
+
+	for (size_t i = 0; i < mCount; ++i)
+	{
+		git_repository * repo = mHandles[i].load(std::memory_order_relaxed);
+		if (repo)
+			git_repository_free(repo);
+	}
+}
+
+GitRepositoryView RepositoryPool::local(const GitRepositoryView & repo)
+{
+	RepositoryPool * pool = gPool.load(std::memory_order_acquire);
+	if (!pool || !repo)
+		return repo;
+
+	LocalHandle & local = tLocal;
+	if (local.pool == pool && local.handle && (repo.get() == local.primary || repo.get() == local.handle))
+		return local.handle;
+
+	if (!pool->owns(repo.get()))
+		return repo;
+
+	if (local.pool != pool)
+	{
+		local.pool = pool;
+		local.slot = pool->mNextSlot.fetch_add(1, std::memory_order_relaxed) % pool->mCount;
+		local.primary = pool->mPrimary.get();
+	}
+
+	local.handle = pool->handle(local.slot);
+	return (local.handle ? GitRepositoryView(local.handle) : repo);
+}
+
+void RepositoryPool::setObjectCacheSize(size_t bytes)
+{
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, ssize_t(bytes));
+}
+
+git_repository * RepositoryPool::handle(size_t slot)
+{
+	git_repository * repo = mHandles[slot].load(std::memory_order_acquire);
+	if (repo || mPath.empty())
+		return repo;
+
+	std::lock_guard<std::mutex> guard(mOpenLock);
+	repo = mHandles[slot].load(std::memory_order_relaxed);
+	if (!repo && git_repository_open_ext(&repo, mPath.c_str(), GIT_REPOSITORY_OPEN_NO_SEARCH, nullptr) == 0)
+		mHandles[slot].store(repo, std::memory_order_release);
+
+	return repo;
+}
+
+bool RepositoryPool::owns(const git_repository * repo) const
+{
+	if (repo == mPrimary.get())
+		return true;
+
+	for (size_t i = 0; i < mCount; ++i)
+		if (mHandles[i].load(std::memory_order_acquire) == repo)
+			return true;
+
+	return false;
+}
@@ -0,0 +1,51 @@
+#ifndef REPOSITORY_POOL_H_
+#define REPOSITORY_POOL_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "git_wrappers.h"
+
+/*
+ * Extra libgit2 handles opened on the same repository as the mount, so that
+ * worker threads don't all serialize on the object cache and pack locks of a
+ * single git_repository. Each thread is bound round-robin to one handle on
+ * first use; handles are opened lazily and live as long as the pool.
+ *
+ * Objects are shared between threads through the gitfs caches, libgit2's own
+ * per-handle cache only has to absorb short term reuse.
+ */
+class RepositoryPool
+{
+public:
+	RepositoryPool(const GitRepositoryView & primary, size_t handles);
+	RepositoryPool(const RepositoryPool & other) = delete;
+	~RepositoryPool();
+
+	// Handle of the calling thread for the repository of repo, which may be
+	// the primary repository or any pooled handle. Returns repo itself if it
+	// doesn't belong to a pool.
+	static GitRepositoryView local(const GitRepositoryView & repo);
+
+	// Byte limit of libgit2's object cache. libgit2 accounts this limit over
+	// all open handles together, not per handle.
+	static void setObjectCacheSize(size_t bytes);
+
+	inline size_t handleCount() const { return mCount; }
+
+private:
+	git_repository * handle(size_t slot);
+	bool owns(const git_repository * repo) const;
+
+	GitRepositoryView mPrimary;
+	std::string mPath;
+	size_t mCount;
+	std::unique_ptr<std::atomic<git_repository *>[]> mHandles;
+	std::atomic<size_t> mNextSlot;
+	std::mutex mOpenLock;
+
+	static std::atomic<RepositoryPool *> gPool;
+};
+
+#endif // REPOSITORY_POOL_H_
@@ -0,0 +1,149 @@
+#ifndef SHARDED_MAP_H_
+#define SHARDED_MAP_H_
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+/*
+ * Hash map split into independently locked shards so concurrent FUSE workers
+ * rarely contend. Readers take a shared lock on a single shard. When a shard
+ * is full an arbitrary entry is dropped; callers use this for caches only.
+ */
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class ShardedMap
+{
+public:
+	inline ShardedMap(size_t maxEntries = 1 << 20)
+	{
+		mShards.reset(new Shard[NrShards]);
+		mMaxShardEntries = std::max<size_t>(maxEntries / NrShards, 16);
+	}
+
+	ShardedMap(const ShardedMap & other) = delete;
+
+	// Calls accept() on the stored value under the shard lock, the lookup
+	// only counts as a hit if accept() returns true
+	template <typename Accept>
+	bool find(const Key & key, Accept && accept) const
+	{
+		size_t hash = Hash()(key);
+		const Shard & shard = shardFor(hash);
+
+		std::shared_lock<std::shared_mutex> guard(shard.lock);
+		auto iter = shard.entries.find(key);
+		return iter != shard.entries.end() && accept(iter->second);
+	}
+
+	bool find(const Key & key, Value & value) const
+	{
+		return find(key, [&value] (const Value & stored) -> bool { value = stored; return true; });
+	}
+
+	bool contains(const Key & key) const
+	{
+		return find(key, [] (const Value &) -> bool { return true; });
+	}
+
+	void insert(Key key, Value value)
+	{
+		size_t hash = Hash()(key);
+		Shard & shard = shardFor(hash);
+
+		std::lock_guard<std::shared_mutex> guard(shard.lock);
+		if (shard.entries.size() >= mMaxShardEntries && shard.entries.find(key) == shard.entries.end())
+			shard.entries.erase(shard.entries.begin());
+
+		shard.entries.insert_or_assign(std::move(key), std::move(value));
+	}
+
+	bool erase(const Key & key)
+	{
+		size_t hash = Hash()(key);
+		Shard & shard = shardFor(hash);
+
+		std::lock_guard<std::shared_mutex> guard(shard.lock);
+		return shard.entries.erase(key) > 0;
+	}
+
+	template <typename Predicate>
+	size_t eraseIf(Predicate && predicate)
+	{
+		size_t count = 0;
+
+		for (size_t i = 0; i < NrShards; ++i)
+		{
+			Shard & shard = mShards[i];
+			std::lock_guard<std::shared_mutex> guard(shard.lock);
+
+			for (auto iter = shard.entries.begin(); iter != shard.entries.end(); )
+			{
+				if (predicate(iter->first, iter->second))
+				{
+					iter = shard.entries.erase(iter);
+					++count;
+				}
+				else
+				{
+					++iter;
+				}
+			}
+		}
+
+		return count;
+	}
+
+	// Calls visit on every entry under its shard lock, visit must not use the map
+	template <typename Visit>
+	void forEach(Visit && visit) const
+	{
+		for (size_t i = 0; i < NrShards; ++i)
+		{
+			std::shared_lock<std::shared_mutex> guard(mShards[i].lock);
+			for (const auto & entry : mShards[i].entries)
+				visit(entry.first, entry.second);
+		}
+	}
+
+	void clear()
+	{
+		for (size_t i = 0; i < NrShards; ++i)
+		{
+			std::lock_guard<std::shared_mutex> guard(mShards[i].lock);
+			mShards[i].entries.clear();
+		}
+	}
+
+	size_t size() const
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < NrShards; ++i)
+		{
+			std::shared_lock<std::shared_mutex> guard(mShards[i].lock);
+			count += mShards[i].entries.size();
+		}
+		return count;
+	}
+
+private:
+	struct Shard
+	{
+		mutable std::shared_mutex lock;
+		std::unordered_map<Key, Value, Hash> entries;
+	};
+
+	static constexpr size_t NrShards = 64;
+
+	inline Shard & shardFor(size_t hash) const
+	{
+		return mShards[(hash >> 7) % NrShards];
+	}
+
+	std::unique_ptr<Shard[]> mShards;
+	size_t mMaxShardEntries;
+};
+
+#endif // SHARDED_MAP_H_
@@ -0,0 +1,486 @@
+#include "tree_index.h"
+#include "atomic_file.h"
+#include "tree_node.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr char Magic[8] = { 'G', 'I', 'T', 'F', 'S', 'T', 'R', 'E' };
+constexpr uint32_t Version = 2;
+// Files are written in host order, one from another byte order is rejected
+constexpr uint32_t ByteOrder = 0x01020304;
+constexpr uint32_t HasSizes = 1;
+
+constexpr size_t WriteChunk = 1 << 20;
+
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t treeCount;
+	uint64_t tableOffset;
+	uint64_t fileSize;
+	uint32_t generation;
+	uint32_t reserved;
+};
+
+// Followed at offset by count entries, count sizes if HasSizes is set,
+// bucketCount buckets and nameBytes of names, padded to 8 bytes
+struct Tree
+{
+	git_oid oid;
+	uint32_t flags;
+	uint64_t offset;
+	uint32_t count;
+	uint32_t bucketCount;
+	uint32_t nameBytes;
+	// Generation of the last save by a mount that used the tree
+	uint32_t used;
+};
+
+static_assert(sizeof(Header) == 48 && sizeof(Tree) == 48, "tree index layout changed");
+static_assert(sizeof(TreeNode::Entry) == 32 && std::is_trivially_copyable<TreeNode::Entry>::value, "tree entries can't be stored as they are");
+
+inline bool oidLess(const git_oid & lhs, const git_oid & rhs)
+{
+	return git_oid_cmp(&lhs, &rhs) < 0;
+}
+
+inline uint64_t blockSize(uint64_t count, uint64_t bucketCount, uint64_t nameBytes, bool hasSizes)
+{
+	uint64_t size = count * sizeof(TreeNode::Entry) + (hasSizes ? count * sizeof(int64_t) : 0) + bucketCount * sizeof(uint32_t) + nameBytes;
+	return (size + 7) & ~uint64_t(7);
+}
+
+inline uint64_t blockSize(const Tree & tree)
+{
+	return blockSize(tree.count, tree.bucketCount, tree.nameBytes, tree.flags & HasSizes);
+}
+
+// Buffers the new file, nothing is written once a write failed
+class Writer
+{
+public:
+	inline Writer(AtomicFile & file) : mFile(file), mOk(file.valid()) { mBuffer.reserve(WriteChunk); }
+
+	void append(const void * data, size_t size)
+	{
+		if (mBuffer.size() + size > WriteChunk)
+			flush();
+		if (size >= WriteChunk)
+			write(static_cast<const char *>(data), size);
+		else
+			mBuffer.append(static_cast<const char *>(data), size);
+	}
+
+	void pad(size_t size)
+	{
+		static const char zeros[8] = {};
+		append(zeros, size);
+	}
+
+	bool flush()
+	{
+		write(mBuffer.data(), mBuffer.size());
+		mBuffer.clear();
+		return mOk;
+	}
+
+private:
+	void write(const char * data, size_t size)
+	{
+		mOk = mOk && mFile.write(data, size);
+	}
+
+	AtomicFile & mFile;
+	bool mOk;
+	std::string mBuffer;
+};
+
+} // namespace
+
+class TreeIndex::Mapping
+{
+public:
+	static std::shared_ptr<const Mapping> open(const std::string & path)
+	{
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return nullptr;
+
+		std::shared_ptr<const Mapping> mapping = open(fd);
+		close(fd);
+		return mapping;
+	}
+
+	static std::shared_ptr<const Mapping> open(int fd)
+	{
+		struct stat st;
+		void * data = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header))
+			data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+			return nullptr;
+
+		std::shared_ptr<Mapping> mapping(new Mapping(static_cast<const char *>(data), st.st_size));
+
+		const Header * header = reinterpret_cast<const Header *>(data);
+		if (std::memcmp(header->magic, Magic, sizeof(Magic)) != 0 || header->version != Version || header->byteOrder != ByteOrder)
+			return nullptr;
+		if (header->fileSize != mapping->mSize || header->tableOffset != sizeof(Header))
+			return nullptr;
+		if (header->treeCount > (mapping->mSize - sizeof(Header)) / sizeof(Tree))
+			return nullptr;
+
+		mapping->mTrees = reinterpret_cast<const Tree *>(mapping->mData + header->tableOffset);
+		mapping->mCount = header->treeCount;
+		mapping->mUsed.reset(new std::atomic<bool>[mapping->mCount]());
+		return mapping;
+	}
+
+	~Mapping()
+	{
+		munmap(const_cast<char *>(mData), mSize);
+	}
+
+	inline const Tree * begin() const { return mTrees; }
+	inline const Tree * end() const { return mTrees + mCount; }
+	inline const char * block(const Tree & tree) const { return mData + tree.offset; }
+	inline uint32_t generation() const { return reinterpret_cast<const Header *>(mData)->generation; }
+
+	inline void markUsed(const Tree & tree) const { mUsed[&tree - mTrees].store(true, std::memory_order_relaxed); }
+	inline bool used(const Tree & tree) const { return mUsed[&tree - mTrees].load(std::memory_order_relaxed); }
+
+	const Tree * find(const git_oid & oid) const
+	{
+		const Tree * tree = std::lower_bound(begin(), end(), oid, [] (const Tree & tree, const git_oid & oid)
+		{
+			return oidLess(tree.oid, oid);
+		});
+		return (tree != end() && tree->oid == oid && valid(*tree) ? tree : nullptr);
+	}
+
+	// A damaged block must not send lookups outside the mapping
+	bool valid(const Tree & tree) const
+	{
+		if (tree.offset % 8 != 0 || tree.offset > mSize || blockSize(tree) > mSize - tree.offset)
+			return false;
+
+		// Probing needs a power of two of buckets with at least one empty
+		if (tree.bucketCount <= tree.count || (tree.bucketCount & (tree.bucketCount - 1)) != 0)
+			return false;
+
+		const char * block = this->block(tree);
+		const TreeNode::Entry * entries = reinterpret_cast<const TreeNode::Entry *>(block);
+		const uint32_t * buckets = reinterpret_cast<const uint32_t *>(block + tree.count * (sizeof(TreeNode::Entry) + ((tree.flags & HasSizes) ? sizeof(int64_t) : 0)));
+		const char * names = reinterpret_cast<const char *>(buckets + tree.bucketCount);
+
+		for (uint32_t i = 0; i < tree.count; ++i)
+		{
+			uint64_t end = uint64_t(entries[i].nameOffset) + entries[i].nameLength;
+			if (end >= tree.nameBytes || names[end] != '\0')
+				return false;
+		}
+
+		bool empty = false;
+		for (uint32_t i = 0; i < tree.bucketCount; ++i)
+		{
+			if (buckets[i] > tree.count)
+				return false;
+			empty = empty || buckets[i] == 0;
+		}
+
+		return empty;
+	}
+
+private:
+	inline Mapping(const char * data, size_t size) : mData(data), mSize(size), mTrees(nullptr), mCount(0) {}
+
+	const char * mData;
+	size_t mSize;
+	const Tree * mTrees;
+	size_t mCount;
+	// Trees this mount loaded
+	std::unique_ptr<std::atomic<bool>[]> mUsed;
+};
+
+TreeIndex & TreeIndex::instance()
+{
+	static TreeIndex index;
+	return index;
+}
+
+TreeIndex::TreeIndex() : mLimit(0)
+{
+}
+
+TreeIndex::~TreeIndex()
+{
+}
+
+void TreeIndex::open(const std::string & path)
+{
+	std::string absolute = path;
+	if (!absolute.empty() && absolute[0] != '/')
+	{
+		// The mount daemonizes into /, keep an absolute path
+		char * cwd = getcwd(nullptr, 0);
+		if (cwd)
+			absolute = std::string(cwd) + '/' + absolute;
+		free(cwd);
+	}
+
+	std::lock_guard<std::mutex> guard(mLock);
+	mPath = std::move(absolute);
+	mMapping = Mapping::open(mPath);
+}
+
+void TreeIndex::setLimit(uint64_t bytes)
+{
+	mLimit = bytes;
+}
+
+std::shared_ptr<const TreeIndex::Mapping> TreeIndex::mapping() const
+{
+	std::lock_guard<std::mutex> guard(mLock);
+	return mMapping;
+}
+
+bool TreeIndex::load(TreeNode & node) const
+{
+	std::shared_ptr<const Mapping> mapping = this->mapping();
+	const Tree * tree = (mapping ? mapping->find(node.mOid) : nullptr);
+	if (!tree)
+		return false;
+
+	mapping->markUsed(*tree);
+	const char * block = mapping->block(*tree);
+	node.mEntryData = reinterpret_cast<const TreeNode::Entry *>(block);
+	node.mCount = tree->count;
+	block += tree->count * sizeof(TreeNode::Entry);
+
+	if (tree->flags & HasSizes)
+	{
+		node.mStoredSizes = reinterpret_cast<const int64_t *>(block);
+		block += tree->count * sizeof(int64_t);
+	}
+
+	node.mBucketData = reinterpret_cast<const uint32_t *>(block);
+	node.mBucketCount = tree->bucketCount;
+	block += tree->bucketCount * sizeof(uint32_t);
+
+	node.mNameData = block;
+	node.mNameBytes = tree->nameBytes;
+	node.mMapping = mapping;
+	return true;
+}
+
+bool TreeIndex::save()
+{
+	if (!enabled())
+		return false;
+
+	struct Source
+	{
+		git_oid oid;
+		bool hasSizes;
+		uint32_t used;
+		uint64_t size;
+		const Tree * stored;
+		std::shared_ptr<const TreeNode> node;
+	};
+
+	// Trees used from the index are only written again if their sizes have
+	// been found meanwhile
+	std::vector<Source> sources;
+	std::unordered_set<git_oid, GitOidHash> used;
+	TreeNode::forEach([&sources, &used] (const std::shared_ptr<const TreeNode> & node)
+	{
+		used.insert(node->id());
+		if (!node->mMapping || (!node->mStoredSizes && node->hasSizes()))
+			sources.push_back(Source{ node->id(), node->hasSizes(), 0, 0, nullptr, node });
+	});
+
+	// Trees loaded from the index may have left the tree cache since
+	std::shared_ptr<const Mapping> mine = mapping();
+	if (mine)
+	{
+		for (const Tree & tree : *mine)
+		{
+			if (mine->used(tree))
+				used.insert(tree.oid);
+		}
+	}
+
+	// Other mounts may have saved since this one mapped the file
+	int fd = ::open(mPath.c_str(), O_RDWR | O_CLOEXEC);
+	std::shared_ptr<const Mapping> existing = (fd >= 0 ? Mapping::open(fd) : nullptr);
+	uint32_t generation = (existing ? existing->generation() + 1 : 1);
+
+	if (sources.empty())
+	{
+		// Nothing to add, only remember what was used so it isn't evicted
+		bool success = true;
+		if (existing)
+		{
+			for (const Tree & tree : *existing)
+			{
+				if (used.count(tree.oid))
+				{
+					off_t offset = sizeof(Header) + (&tree - existing->begin()) * sizeof(Tree) + offsetof(Tree, used);
+					success = success && pwrite(fd, &generation, sizeof(generation), offset) == sizeof(generation);
+				}
+			}
+			success = success && pwrite(fd, &generation, sizeof(generation), offsetof(Header, generation)) == sizeof(generation);
+		}
+		if (fd >= 0)
+			close(fd);
+		return success;
+	}
+
+	if (fd >= 0)
+		close(fd);
+
+	if (existing)
+	{
+		for (const Tree & tree : *existing)
+		{
+			if (existing->valid(tree))
+				sources.push_back(Source{ tree.oid, bool(tree.flags & HasSizes), tree.used, 0, &tree, nullptr });
+		}
+	}
+
+	// Of the same tree, keep one with sizes, preferably already stored
+	std::sort(sources.begin(), sources.end(), [] (const Source & lhs, const Source & rhs)
+	{
+		int cmp = git_oid_cmp(&lhs.oid, &rhs.oid);
+		if (cmp != 0)
+			return cmp < 0;
+		if (lhs.hasSizes != rhs.hasSizes)
+			return lhs.hasSizes;
+		return lhs.stored && !rhs.stored;
+	});
+	sources.erase(std::unique(sources.begin(), sources.end(), [] (const Source & lhs, const Source & rhs)
+	{
+		return lhs.oid == rhs.oid;
+	}), sources.end());
+
+	uint64_t total = sizeof(Header);
+	for (Source & source : sources)
+	{
+		if (used.count(source.oid))
+			source.used = generation;
+
+		if (source.stored)
+			source.size = blockSize(*source.stored);
+		else
+			source.size = blockSize(source.node->mCount, source.node->mBucketCount, source.node->mNameBytes, source.hasSizes);
+		source.size += sizeof(Tree);
+		total += source.size;
+	}
+
+	// Beyond the limit the trees used longest ago are dropped
+	if (mLimit && total > mLimit)
+	{
+		std::stable_sort(sources.begin(), sources.end(), [] (const Source & lhs, const Source & rhs)
+		{
+			return lhs.used > rhs.used;
+		});
+
+		total = sizeof(Header);
+		size_t kept = 0;
+		while (kept < sources.size() && total + sources[kept].size <= mLimit)
+			total += sources[kept++].size;
+		sources.resize(kept);
+
+		std::sort(sources.begin(), sources.end(), [] (const Source & lhs, const Source & rhs)
+		{
+			return oidLess(lhs.oid, rhs.oid);
+		});
+	}
+
+	std::vector<Tree> table(sources.size());
+	uint64_t offset = sizeof(Header) + table.size() * sizeof(Tree);
+	for (size_t i = 0; i < sources.size(); ++i)
+	{
+		const Source & source = sources[i];
+		Tree & tree = table[i];
+
+		if (source.stored)
+		{
+			tree = *source.stored;
+		}
+		else
+		{
+			tree = {};
+			tree.oid = source.oid;
+			tree.flags = (source.hasSizes ? HasSizes : 0);
+			tree.count = uint32_t(source.node->mCount);
+			tree.bucketCount = uint32_t(source.node->mBucketCount);
+			tree.nameBytes = uint32_t(source.node->mNameBytes);
+		}
+
+		tree.used = source.used;
+		tree.offset = offset;
+		offset += blockSize(tree);
+	}
+
+	Header header = {};
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.byteOrder = ByteOrder;
+	header.treeCount = table.size();
+	header.tableOffset = sizeof(Header);
+	header.fileSize = offset;
+	header.generation = generation;
+
+	AtomicFile file(mPath);
+	Writer writer(file);
+	writer.append(&header, sizeof(header));
+	writer.append(table.data(), table.size() * sizeof(Tree));
+
+	for (size_t i = 0; i < sources.size(); ++i)
+	{
+		const Source & source = sources[i];
+		uint64_t size = blockSize(table[i]);
+
+		if (source.stored)
+		{
+			writer.append(existing->block(*source.stored), size);
+			continue;
+		}
+
+		const TreeNode & node = *source.node;
+		uint64_t written = node.mCount * sizeof(TreeNode::Entry) + node.mBucketCount * sizeof(uint32_t) + node.mNameBytes;
+
+		writer.append(node.mEntryData, node.mCount * sizeof(TreeNode::Entry));
+		if (source.hasSizes)
+		{
+			for (size_t entry = 0; entry < node.mCount; ++entry)
+			{
+				int64_t entrySize = node.size(entry);
+				writer.append(&entrySize, sizeof(entrySize));
+			}
+			written += node.mCount * sizeof(int64_t);
+		}
+		writer.append(node.mBucketData, node.mBucketCount * sizeof(uint32_t));
+		writer.append(node.mNameData, node.mNameBytes);
+		writer.pad(size - written);
+	}
+
+	return writer.flush() && file.commit(0644);
+}
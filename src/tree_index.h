@@ -0,0 +1,57 @@
+#ifndef TREE_INDEX_H_
+#define TREE_INDEX_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "git_wrappers.h"
+
+class TreeNode;
+
+/*
+ * Decoded trees kept on disk across mounts: tree oid to entries (name, mode,
+ * child oid) with their name index and, once known, the object sizes. The
+ * file is flat and free of pointers, a table of trees sorted by oid followed
+ * by one block per tree laid out the way TreeNode keeps it in memory, so a
+ * mapped tree is used in place and the mapping is shared through the page
+ * cache by every mount reading it. Trees decoded while mounted are merged
+ * into the file at unmount; the file is written aside and renamed, readers
+ * keep the version they mapped. Every save is a generation, trees remember
+ * the last one that used them and the oldest go first once the file would
+ * outgrow its limit.
+ */
+class TreeIndex
+{
+public:
+	static TreeIndex & instance();
+
+	// Maps the index at path if it exists, it is created by the first save
+	void open(const std::string & path);
+	// Bytes the file may take, 0 for no limit
+	void setLimit(uint64_t bytes);
+
+	inline bool enabled() const { return !mPath.empty(); }
+
+	// Points node at its tree in the index, false if the index doesn't have it
+	bool load(TreeNode & node) const;
+
+	// Merges the trees in memory into the file on disk, or only records
+	// which trees were used if none are new
+	bool save();
+
+private:
+	class Mapping;
+
+	TreeIndex();
+	~TreeIndex();
+
+	std::shared_ptr<const Mapping> mapping() const;
+
+	std::string mPath;
+	uint64_t mLimit;
+	mutable std::mutex mLock;
+	std::shared_ptr<const Mapping> mMapping;
+};
+
+#endif // TREE_INDEX_H_
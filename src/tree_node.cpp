@@ -0,0 +1,214 @@
+#include "tree_node.h"
+#include "fs_entry.h"
+#include "object_sizes.h"
+#include "repository_pool.h"
+#include "tree_index.h"
+
+namespace
+{
+
+// FNV-1a rather than std::hash, the buckets are stored in the tree index
+// and must hash the same way in every build
+inline size_t nameHash(std::string_view name)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (unsigned char c : name)
+	{
+		hash ^= c;
+		hash *= 0x100000001b3ull;
+	}
+	return size_t(hash);
+}
+
+} // namespace
+
+ShardedMap<git_oid, std::shared_ptr<const TreeNode>, GitOidHash> TreeNode::gNodes(1 << 18);
+
+std::shared_ptr<const TreeNode> TreeNode::get(const GitRepositoryView & repo, const git_oid * oid)
+{
+	if (!oid)
+		return nullptr;
+
+	std::shared_ptr<const TreeNode> node;
+	if (gNodes.find(*oid, node))
+		return node;
+
+	// A tree kept in the index by an earlier mount is used as it is mapped
+	std::shared_ptr<TreeNode> decoded(new TreeNode(repo, *oid));
+	if (!TreeIndex::instance().load(*decoded) && !decoded->decode())
+		return nullptr;
+
+	gNodes.insert(*oid, decoded);
+	return decoded;
+}
+
+TreeNode::TreeNode(const GitRepositoryView & repo, const git_oid & oid) : mRepository(repo), mOid(oid), mEntryData(nullptr), mCount(0), mNameData(""), mNameBytes(0), mBucketData(nullptr), mBucketCount(0), mStoredSizes(nullptr), mSizesReady(false)
+{
+}
+
+TreeNode::~TreeNode()
+{
+}
+
+bool TreeNode::decode()
+{
+	GitTree tree = RepositoryPool::local(mRepository).resolveTree(&mOid);
+	if (!tree)
+		return false;
+
+	size_t count = tree.entryCount();
+	mEntries.reserve(count);
+	mNames.reserve(count * 16);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		GitTreeEntryView view = tree.byIndex(i);
+		std::string_view name(view.name());
+
+		Entry entry;
+		entry.oid = *view.id();
+		entry.mode = view.mode();
+		entry.nameOffset = mNames.size();
+		entry.nameLength = name.size();
+		mEntries.push_back(entry);
+
+		mNames.append(name);
+		mNames.push_back('\0');
+	}
+
+	buildIndex();
+
+	mEntryData = mEntries.data();
+	mCount = mEntries.size();
+	mNameData = mNames.data();
+	mNameBytes = mNames.size();
+	mBucketData = mBuckets.data();
+	mBucketCount = mBuckets.size();
+	return true;
+}
+
+void TreeNode::buildIndex()
+{
+	size_t buckets = 8;
+	while (buckets < mEntries.size() * 2)
+		buckets <<= 1;
+
+	// Bucket values are entry index + 1, zero marks an empty bucket
+	mBuckets.assign(buckets, 0);
+	for (size_t i = 0; i < mEntries.size(); ++i)
+	{
+		std::string_view name(mNames.data() + mEntries[i].nameOffset, mEntries[i].nameLength);
+		size_t bucket = nameHash(name) & (buckets - 1);
+		while (mBuckets[bucket] != 0)
+			bucket = (bucket + 1) & (buckets - 1);
+		mBuckets[bucket] = i + 1;
+	}
+}
+
+size_t TreeNode::find(std::string_view name) const
+{
+	size_t mask = mBucketCount - 1;
+	size_t bucket = nameHash(name) & mask;
+
+	while (mBucketData[bucket] != 0)
+	{
+		size_t index = mBucketData[bucket] - 1;
+		if (std::string_view(this->name(index), mEntryData[index].nameLength) == name)
+			return index;
+		bucket = (bucket + 1) & mask;
+	}
+
+	return npos;
+}
+
+void TreeNode::resolveSizes() const
+{
+	mSizes.assign(mCount, 0);
+
+	std::vector<size_t> blobs;
+	std::vector<git_oid> oids;
+	for (size_t i = 0; i < mCount; ++i)
+	{
+		switch (mEntryData[i].mode)
+		{
+			case GIT_FILEMODE_BLOB:
+			case GIT_FILEMODE_BLOB_EXECUTABLE:
+			case GIT_FILEMODE_LINK:
+				blobs.push_back(i);
+				oids.push_back(mEntryData[i].oid);
+				break;
+			default:
+				break;
+		}
+	}
+
+	// Tree order jumps around the packs, the headers are read in pack order instead
+	std::vector<off_t> sizes = ObjectSizes::objectSizes(mRepository, oids);
+	for (size_t i = 0; i < blobs.size(); ++i)
+		mSizes[blobs[i]] = sizes[i];
+
+	mSizesReady.store(true, std::memory_order_release);
+}
+
+off_t TreeNode::size(size_t index) const
+{
+	if (mStoredSizes)
+		return off_t(mStoredSizes[index]);
+
+	std::call_once(mSizesResolved, [this] () { resolveSizes(); });
+	return mSizes[index];
+}
+
+bool TreeNode::hasSizes() const
+{
+	return mStoredSizes || mSizesReady.load(std::memory_order_acquire);
+}
+
+void TreeNode::buildDirents() const
+{
+	auto list = std::make_shared<DirentList>();
+	list->reserve(mCount, mNameBytes);
+
+	for (size_t i = 0; i < mCount; ++i)
+	{
+		const Entry & entry = mEntryData[i];
+
+		struct stat st = {};
+		switch (entry.mode)
+		{
+			case GIT_FILEMODE_TREE:
+				st.st_mode = 0777 | S_IFDIR;
+				st.st_nlink = 1;
+				break;
+			case GIT_FILEMODE_BLOB:
+				st.st_mode = 0666 | S_IFREG;
+				st.st_nlink = 2;
+				st.st_size = size(i);
+				break;
+			case GIT_FILEMODE_BLOB_EXECUTABLE:
+				st.st_mode = 0777 | S_IFREG;
+				st.st_nlink = 2;
+				st.st_size = size(i);
+				break;
+			case GIT_FILEMODE_LINK:
+				st.st_mode = 0666 | S_IFLNK;
+				st.st_nlink = 2;
+				st.st_size = size(i);
+				break;
+			default:
+				// Submodules and unreadable entries are not shown
+				continue;
+		}
+
+		st.st_ino = FSEntry::inodeFromOid(&entry.oid);
+		list->add(std::string_view(name(i), entry.nameLength), st);
+	}
+
+	mDirents = std::move(list);
+}
+
+std::shared_ptr<const DirentList> TreeNode::dirents() const
+{
+	std::call_once(mDirentsBuilt, [this] () { buildDirents(); });
+	return mDirents;
+}
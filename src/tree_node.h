@@ -0,0 +1,104 @@
+#ifndef TREE_NODE_H_
+#define TREE_NODE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/types.h>
+#include "dirent_list.h"
+#include "git_wrappers.h"
+#include "sharded_map.h"
+
+/*
+ * Decoded form of a git tree, shared by every FSTree that shows the same
+ * tree oid regardless of the commit or branch it was reached through. Names
+ * are kept in a single buffer with an open addressing hash index on top, so
+ * a lookup in a huge directory costs the same as in a small one. Entries,
+ * names and index are plain arrays, which lets a tree kept in the TreeIndex
+ * be used straight from its mapping without decoding anything.
+ */
+class TreeNode
+{
+public:
+	struct Entry
+	{
+		git_oid oid;
+		git_filemode_t mode;
+		uint32_t nameOffset;
+		uint32_t nameLength;
+	};
+
+	static constexpr size_t npos = size_t(-1);
+
+public:
+	static std::shared_ptr<const TreeNode> get(const GitRepositoryView & repo, const git_oid * oid);
+
+	TreeNode(const TreeNode & other) = delete;
+	~TreeNode();
+
+	inline const git_oid & id() const { return mOid; }
+	inline size_t count() const { return mCount; }
+	inline const Entry & entry(size_t index) const { return mEntryData[index]; }
+
+	// Names are nul terminated within the buffer
+	inline const char * name(size_t index) const { return mNameData + mEntryData[index].nameOffset; }
+
+	size_t find(std::string_view name) const;
+
+	// Header sizes of all blob entries, resolved together on first use
+	off_t size(size_t index) const;
+	// Whether size() answers without reading object headers
+	bool hasSizes() const;
+
+	// Readdir listing of the visible entries, built once on first use
+	std::shared_ptr<const DirentList> dirents() const;
+
+	// Calls visit on every tree in memory
+	template <typename Visit>
+	static void forEach(Visit && visit)
+	{
+		gNodes.forEach([&visit] (const git_oid &, const std::shared_ptr<const TreeNode> & node) { visit(node); });
+	}
+
+private:
+	friend class TreeIndex;
+
+	TreeNode(const GitRepositoryView & repo, const git_oid & oid);
+	bool decode();
+	void buildIndex();
+	void resolveSizes() const;
+	void buildDirents() const;
+
+	static ShardedMap<git_oid, std::shared_ptr<const TreeNode>, GitOidHash> gNodes;
+
+	GitRepositoryView mRepository;
+	git_oid mOid;
+
+	// Point into the vectors below for decoded trees, and into the mapping
+	// of the tree index for trees loaded from there
+	const Entry * mEntryData;
+	size_t mCount;
+	const char * mNameData;
+	size_t mNameBytes;
+	const uint32_t * mBucketData;
+	size_t mBucketCount;
+	const int64_t * mStoredSizes;
+	std::shared_ptr<const void> mMapping;
+
+	std::vector<Entry> mEntries;
+	std::string mNames;
+	std::vector<uint32_t> mBuckets;
+
+	mutable std::once_flag mSizesResolved;
+	mutable std::vector<off_t> mSizes;
+	mutable std::atomic<bool> mSizesReady;
+
+	mutable std::once_flag mDirentsBuilt;
+	mutable std::shared_ptr<const DirentList> mDirents;
+};
+
+#endif // TREE_NODE_H_
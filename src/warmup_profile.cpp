@@ -0,0 +1,362 @@
+#include "warmup_profile.h"
+#include "atomic_file.h"
+#include "batch_loader.h"
+#include "blob_cache.h"
+#include "object_sizes.h"
+#include "repository_pool.h"
+#include "tree_node.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr char Magic[4] = { 'G', 'F', 'S', 'W' };
+constexpr uint32_t Version = 1;
+constexpr size_t OidSize = sizeof(git_oid::id);
+
+// Upper bound for the objects of a trace
+constexpr size_t MaxRecords = 1 << 20;
+
+// ioprio_set has no libc wrapper
+constexpr int IoprioWhoProcess = 1;
+constexpr int IoprioClassIdle = 3;
+constexpr int IoprioClassShift = 13;
+
+inline bool isZero(const git_oid & oid)
+{
+	static const git_oid zero = {};
+	return oid == zero;
+}
+
+inline bool isTree(git_filemode_t mode)
+{
+	return mode == GIT_FILEMODE_TREE;
+}
+
+void appendU32(std::string & buffer, uint32_t value)
+{
+	value = htole32(value);
+	buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void appendOid(std::string & buffer, const git_oid & oid)
+{
+	buffer.append(reinterpret_cast<const char *>(oid.id), OidSize);
+}
+
+// Consumes bytes from the front of the file contents, failing once short
+class Reader
+{
+public:
+	inline Reader(std::string_view data) : mData(data) {}
+
+	bool u32(uint32_t & value)
+	{
+		if (mData.size() < sizeof(value))
+			return false;
+		std::memcpy(&value, mData.data(), sizeof(value));
+		value = le32toh(value);
+		mData.remove_prefix(sizeof(value));
+		return true;
+	}
+
+	bool oid(git_oid & oid)
+	{
+		if (mData.size() < OidSize)
+			return false;
+		std::memcpy(oid.id, mData.data(), OidSize);
+		mData.remove_prefix(OidSize);
+		return true;
+	}
+
+	bool bytes(size_t length, std::string_view & bytes)
+	{
+		if (mData.size() < length)
+			return false;
+		bytes = mData.substr(0, length);
+		mData.remove_prefix(length);
+		return true;
+	}
+
+private:
+	std::string_view mData;
+};
+
+bool readFile(const std::string & path, std::string & contents)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	char buffer[65536];
+	ssize_t got;
+	while ((got = ::read(fd, buffer, sizeof(buffer))) > 0 || (got < 0 && errno == EINTR))
+	{
+		if (got > 0)
+			contents.append(buffer, got);
+	}
+
+	close(fd);
+	return got == 0;
+}
+
+void lowerPriority()
+{
+	// Both apply to the calling thread only
+	setpriority(PRIO_PROCESS, pid_t(syscall(SYS_gettid)), 19);
+	syscall(SYS_ioprio_set, IoprioWhoProcess, 0, IoprioClassIdle << IoprioClassShift);
+}
+
+} // namespace
+
+WarmupProfile::WarmupProfile(const std::string & path, unsigned int seconds) : mPath(path), mWindow(seconds), mRoot{}, mHasRoot(false), mRecording(false), mStopping(false)
+{
+	if (!mPath.empty() && mPath[0] != '/')
+	{
+		char * cwd = getcwd(nullptr, 0);
+		if (cwd)
+			mPath = std::string(cwd) + '/' + mPath;
+		free(cwd);
+	}
+}
+
+WarmupProfile::~WarmupProfile()
+{
+	stop();
+}
+
+void WarmupProfile::start(const GitRepositoryView & repo, const git_oid * root)
+{
+	if (mThread.joinable())
+		return;
+
+	mRepository = repo;
+	mHasRoot = (root != nullptr);
+	if (root)
+		mRoot = *root;
+
+	mStopping = false;
+	mRecording.store(true, std::memory_order_relaxed);
+	mThread = std::thread(&WarmupProfile::run, this);
+}
+
+void WarmupProfile::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(mLock);
+		mStopping = true;
+	}
+	mWake.notify_all();
+
+	if (mThread.joinable())
+		mThread.join();
+}
+
+bool WarmupProfile::stopping()
+{
+	std::lock_guard<std::mutex> guard(mLock);
+	return mStopping;
+}
+
+void WarmupProfile::touched(const git_oid * parent, std::string_view name, const git_oid & oid)
+{
+	record(parent, name, oid, GIT_FILEMODE_TREE);
+}
+
+void WarmupProfile::opened(const git_oid & parent, std::string_view name, const git_oid & oid)
+{
+	record(&parent, name, oid, GIT_FILEMODE_BLOB);
+}
+
+void WarmupProfile::record(const git_oid * parent, std::string_view name, const git_oid & oid, git_filemode_t mode)
+{
+	std::lock_guard<std::mutex> guard(mLock);
+	if (!mRecording.load(std::memory_order_relaxed) || mRecords.size() >= MaxRecords || !mSeen.insert(oid).second)
+		return;
+
+	Record record = {};
+	if (parent)
+	{
+		record.parent = *parent;
+		record.name = std::string(name);
+	}
+	record.oid = oid;
+	record.mode = mode;
+	mRecords.push_back(std::move(record));
+}
+
+void WarmupProfile::run()
+{
+	auto deadline = std::chrono::steady_clock::now() + mWindow;
+
+	std::vector<Record> records;
+	git_oid recordedRoot;
+	bool hasRoot = false;
+	if (load(records, recordedRoot, hasRoot))
+	{
+		lowerPriority();
+		replay(records, hasRoot ? &recordedRoot : nullptr);
+	}
+	records.clear();
+
+	{
+		std::unique_lock<std::mutex> lock(mLock);
+		mWake.wait_until(lock, deadline, [this] { return mStopping; });
+		mRecording.store(false, std::memory_order_relaxed);
+	}
+
+	save();
+}
+
+bool WarmupProfile::load(std::vector<Record> & records, git_oid & root, bool & hasRoot) const
+{
+	std::string contents;
+	if (!readFile(mPath, contents))
+		return false;
+
+	Reader reader(contents);
+	std::string_view magic, repository;
+	uint32_t version, repositoryLength, flags, count;
+	if (!reader.bytes(sizeof(Magic), magic) || magic != std::string_view(Magic, sizeof(Magic)) || !reader.u32(version) || version != Version)
+		return false;
+
+	// A trace of another repository would only load objects that don't exist
+	if (!reader.u32(repositoryLength) || !reader.bytes(repositoryLength, repository) || repository != mRepository.commonDir())
+		return false;
+
+	if (!reader.u32(flags) || !reader.oid(root) || !reader.u32(count) || count > MaxRecords)
+		return false;
+	hasRoot = (flags & 1);
+
+	records.resize(count);
+	for (Record & record : records)
+	{
+		uint32_t mode, nameLength;
+		std::string_view name;
+		if (!reader.oid(record.parent) || !reader.oid(record.oid) || !reader.u32(mode) || !reader.u32(nameLength) || !reader.bytes(nameLength, name))
+			return false;
+		record.mode = git_filemode_t(mode);
+		record.name = std::string(name);
+	}
+
+	return true;
+}
+
+void WarmupProfile::replay(const std::vector<Record> & records, const git_oid * recordedRoot)
+{
+	// Trees of the trace mapped to the trees shown now at the same paths
+	std::unordered_map<git_oid, git_oid, GitOidHash> mapped;
+	if (recordedRoot && mHasRoot)
+		mapped.emplace(*recordedRoot, mRoot);
+
+	if (mHasRoot)
+	{
+		std::shared_ptr<const TreeNode> node = TreeNode::get(mRepository, &mRoot);
+		if (node)
+			node->dirents();
+	}
+
+	// Trees first and in the order they were reached, which resolves every
+	// parent before its children
+	std::vector<git_oid> blobs;
+	for (const Record & record : records)
+	{
+		if (stopping())
+			return;
+
+		git_oid current = record.oid;
+		auto parent = (isZero(record.parent) ? mapped.end() : mapped.find(record.parent));
+		if (parent != mapped.end())
+		{
+			std::shared_ptr<const TreeNode> node = TreeNode::get(mRepository, &parent->second);
+			size_t index = (node ? node->find(record.name) : TreeNode::npos);
+			if (index == TreeNode::npos || isTree(node->entry(index).mode) != isTree(record.mode))
+				continue;
+			current = node->entry(index).oid;
+		}
+
+		if (!isTree(record.mode))
+		{
+			blobs.push_back(current);
+			continue;
+		}
+
+		mapped.emplace(record.oid, current);
+		std::shared_ptr<const TreeNode> node = TreeNode::get(mRepository, &current);
+		if (node)
+			node->dirents();
+	}
+
+	// Blobs last and in pack order, no more than half the blob cache so
+	// they don't push each other out
+	size_t budget = BlobCache::instance().stats().budget / 2;
+	std::vector<off_t> sizes = ObjectSizes::objectSizes(mRepository, blobs);
+
+	BatchLoader batch(mRepository);
+	for (size_t i = 0; i < blobs.size(); ++i)
+	{
+		if (sizes[i] > BlobCache::SmallBlob || size_t(sizes[i]) > budget)
+			continue;
+
+		budget -= sizes[i];
+		batch.add(blobs[i]);
+	}
+
+	batch.run([this] (size_t, const git_oid & oid)
+	{
+		if (stopping())
+			return false;
+
+		BlobCache::instance().get(RepositoryPool::local(mRepository), &oid);
+		return true;
+	});
+}
+
+void WarmupProfile::save()
+{
+	std::vector<Record> records;
+	{
+		std::lock_guard<std::mutex> guard(mLock);
+		records.swap(mRecords);
+		mSeen.clear();
+	}
+
+	// An idle mount keeps the trace of the last one that did something
+	if (records.empty())
+		return;
+
+	std::string contents(Magic, sizeof(Magic));
+	appendU32(contents, Version);
+
+	std::string repository = mRepository.commonDir();
+	appendU32(contents, uint32_t(repository.size()));
+	contents += repository;
+
+	appendU32(contents, mHasRoot ? 1 : 0);
+	appendOid(contents, mRoot);
+	appendU32(contents, uint32_t(records.size()));
+
+	for (const Record & record : records)
+	{
+		appendOid(contents, record.parent);
+		appendOid(contents, record.oid);
+		appendU32(contents, uint32_t(record.mode));
+		appendU32(contents, uint32_t(record.name.size()));
+		contents += record.name;
+	}
+
+	// Written aside and renamed over, a reader never sees half a trace
+	AtomicFile file(mPath);
+	if (!file.write(contents.data(), contents.size()) || !file.commit(0644))
+		std::cerr << "gitfs mount: can't write warm-up profile " << mPath << std::endl;
+}
@@ -0,0 +1,76 @@
+#ifndef WARMUP_PROFILE_H_
+#define WARMUP_PROFILE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "git_wrappers.h"
+
+/*
+ * Trace of the trees and blobs a mount touched in its first seconds, kept
+ * in a file so the next mount of the same repository can warm them up
+ * before they are asked for. Every record names the tree it was found in
+ * and its name there, so when the mounted tip has moved on since, the trace
+ * is followed by path through the new trees instead of loading objects that
+ * are no longer shown. Replaying runs on a thread of its own at idle CPU and
+ * IO priority; recording a new trace starts when the mount does.
+ */
+class WarmupProfile
+{
+public:
+	// Relative paths are taken from the current directory, before the mount daemonizes
+	WarmupProfile(const std::string & path, unsigned int seconds);
+	WarmupProfile(const WarmupProfile & other) = delete;
+	~WarmupProfile();
+
+	// Replays the last trace against the mounted root tree, if there is one,
+	// and records until the window closes or the profile is stopped
+	void start(const GitRepositoryView & repo, const git_oid * root);
+	void stop();
+
+	inline bool recording() const { return mRecording.load(std::memory_order_relaxed); }
+
+	// Tree oid was reached as name in tree parent, or on its own without a parent
+	void touched(const git_oid * parent, std::string_view name, const git_oid & oid);
+	// Blob oid was opened as name in tree parent; files that are only listed
+	// or looked up have their sizes in the tree listings already
+	void opened(const git_oid & parent, std::string_view name, const git_oid & oid);
+
+private:
+	struct Record
+	{
+		git_oid parent;
+		git_oid oid;
+		git_filemode_t mode;
+		std::string name;
+	};
+
+	void record(const git_oid * parent, std::string_view name, const git_oid & oid, git_filemode_t mode);
+	void run();
+	bool load(std::vector<Record> & records, git_oid & root, bool & hasRoot) const;
+	void replay(const std::vector<Record> & records, const git_oid * recordedRoot);
+	void save();
+	bool stopping();
+
+	std::string mPath;
+	std::chrono::seconds mWindow;
+	GitRepositoryView mRepository;
+	git_oid mRoot;
+	bool mHasRoot;
+
+	std::atomic<bool> mRecording;
+	std::mutex mLock;
+	std::condition_variable mWake;
+	bool mStopping;
+	std::vector<Record> mRecords;
+	std::unordered_set<git_oid, GitOidHash> mSeen;
+	std::thread mThread;
+};
+
+#endif // WARMUP_PROFILE_H_
@@ -0,0 +1,102 @@
+#include "work_stealing_pool.h"
+#include <algorithm>
+
+namespace
+{
+
+// Pool and index of the worker running on this thread, if any
+thread_local const WorkStealingPool * tPool = nullptr;
+thread_local size_t tWorker = 0;
+
+} // namespace
+
+WorkStealingPool::WorkStealingPool(size_t threads) : mPending(0), mNext(0), mStopping(false)
+{
+	threads = std::max<size_t>(threads, 1);
+	for (size_t i = 0; i < threads; ++i)
+		mWorkers.emplace_back(new Worker());
+	for (size_t i = 0; i < threads; ++i)
+		mThreads.emplace_back(&WorkStealingPool::run, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(mIdleLock);
+		mStopping = true;
+	}
+	mWake.notify_all();
+
+	for (auto & thread : mThreads)
+		thread.join();
+}
+
+void WorkStealingPool::submit(Task task)
+{
+	size_t index = (tPool == this ? tWorker : mNext.fetch_add(1, std::memory_order_relaxed) % mWorkers.size());
+
+	// Counted before it is published, a worker that takes it right away
+	// must not bring the count below zero. Taking the idle lock orders this
+	// with a worker about to sleep.
+	{
+		std::lock_guard<std::mutex> guard(mIdleLock);
+		++mPending;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(mWorkers[index]->lock);
+		mWorkers[index]->tasks.push_back(std::move(task));
+	}
+	mWake.notify_one();
+}
+
+bool WorkStealingPool::take(size_t self, Task & task)
+{
+	{
+		Worker & own = *mWorkers[self];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (size_t i = 1; i < mWorkers.size(); ++i)
+	{
+		Worker & victim = *mWorkers[(self + i) % mWorkers.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void WorkStealingPool::run(size_t self)
+{
+	tPool = this;
+	tWorker = self;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mIdleLock);
+			mWake.wait(lock, [this] { return mStopping || mPending > 0; });
+			if (mStopping)
+				break;
+		}
+
+		Task task;
+		if (!take(self, task))
+			continue;
+
+		--mPending;
+		task();
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef WORK_STEALING_POOL_H_
+#define WORK_STEALING_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Thread pool where every worker has its own deque of tasks. A task
+ * submitted from a worker goes to the back of that worker's deque and is
+ * taken from there first, so work spawned while walking a tree is done
+ * depth first and stays close to what was just decoded. Idle workers steal
+ * from the front of the other deques, where the oldest and broadest work
+ * waits. Tasks submitted from outside are spread round-robin. Queued tasks
+ * are dropped when the pool is destroyed.
+ */
+class WorkStealingPool
+{
+public:
+	using Task = std::function<void()>;
+
+public:
+	WorkStealingPool(size_t threads);
+	WorkStealingPool(const WorkStealingPool & other) = delete;
+	~WorkStealingPool();
+
+	void submit(Task task);
+
+	inline size_t pending() const { return mPending.load(std::memory_order_relaxed); }
+
+private:
+	struct Worker
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	bool take(size_t self, Task & task);
+	void run(size_t self);
+
+	std::vector<std::unique_ptr<Worker>> mWorkers;
+	std::vector<std::thread> mThreads;
+	std::atomic<size_t> mPending;
+	std::atomic<size_t> mNext;
+	std::atomic<bool> mStopping;
+	std::mutex mIdleLock;
+	std::condition_variable mWake;
+};
+
+#endif // WORK_STEALING_POOL_H_
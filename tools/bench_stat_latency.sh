@@ -0,0 +1,75 @@
+#!/bin/sh
+# Measures stat latency while large blobs are read at the same time, with
+# requests served in place and with inflating requests on their own
+# threads. Readers cat the largest blobs of a commit over and over with the
+# blob cache disabled, so every read inflates again; meanwhile every file
+# of the commit is stat'ed and the p50, p99 and max latencies are reported.
+#
+# usage: tools/bench_stat_latency.sh <gitfs binary> <repository> [commit] [readers] [seconds]
+
+set -eu
+
+GITFS=${1:?gitfs binary required}
+REPO=${2:?repository required}
+COMMIT=${3:-$(git -C "$REPO" rev-parse HEAD)}
+READERS=${4:-8}
+SECONDS_PER_RUN=${5:-20}
+
+MNT=$(mktemp -d)
+LIST=$(mktemp)
+BIG=$(mktemp)
+trap 'kill $(jobs -p) 2>/dev/null || true; fusermount3 -uq "$MNT" 2>/dev/null || true; rmdir "$MNT"; rm -f "$LIST" "$BIG"' EXIT
+
+git -C "$REPO" ls-tree -r -l "$COMMIT" | sort -k4 -n -r | head -n "$READERS" | cut -f2 > "$BIG"
+
+run()
+{
+	name=$1
+	shift
+
+	"$GITFS" mount "$REPO" "$MNT" -o commit="$COMMIT" -o blob_cache=0 "$@"
+	find "$MNT" -type f > "$LIST"
+
+	pids=""
+	while read -r path; do
+		( while :; do cat "$MNT/$path" > /dev/null; done ) &
+		pids="$pids $!"
+	done < "$BIG"
+
+	# The kernel caches attributes of a commit for good, dropping them every
+	# pass so each stat reaches gitfs needs root
+	python3 - "$LIST" "$SECONDS_PER_RUN" "$name" <<'EOF'
+import os, sys, time
+
+paths = [line.rstrip('\n') for line in open(sys.argv[1])]
+deadline = time.monotonic() + float(sys.argv[2])
+samples = []
+warned = False
+while time.monotonic() < deadline:
+	try:
+		with open('/proc/sys/vm/drop_caches', 'w') as caches:
+			caches.write('2')
+	except OSError:
+		if not warned:
+			print('can\'t drop the kernel caches, only the first pass reaches gitfs', file=sys.stderr)
+			warned = True
+	for path in paths:
+		start = time.perf_counter_ns()
+		os.stat(path)
+		samples.append(time.perf_counter_ns() - start)
+		if time.monotonic() >= deadline:
+			break
+
+samples.sort()
+def pct(p):
+	return samples[min(len(samples) - 1, int(len(samples) * p))] / 1000.0
+print('%-9s stats=%-8d p50=%.0fus p99=%.0fus max=%.0fus' % (sys.argv[3], len(samples), pct(0.50), pct(0.99), samples[-1] / 1000.0))
+EOF
+
+	kill $pids 2>/dev/null || true
+	wait 2>/dev/null || true
+	fusermount3 -uq "$MNT"
+}
+
+run inplace -o async_threads=0
+run async
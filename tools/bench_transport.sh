@@ -0,0 +1,71 @@
+#!/bin/sh
+# Compares metadata heavy workloads between the /dev/fuse and io_uring
+# transports of gitfs: a find over a whole commit and a parallel stat storm
+# over every file in it.
+#
+# Every round drops the kernel dentry and inode caches so it reaches gitfs
+# again, which needs root.
+#
+# usage: tools/bench_transport.sh <gitfs binary> <repository> [commit] [jobs] [rounds]
+
+set -eu
+
+GITFS=${1:?gitfs binary required}
+REPO=${2:?repository required}
+COMMIT=${3:-$(git -C "$REPO" rev-parse HEAD)}
+JOBS=${4:-$(nproc)}
+ROUNDS=${5:-5}
+
+if [ ! -w /proc/sys/vm/drop_caches ]; then
+	echo "dropping the kernel caches between rounds needs root" >&2
+	exit 1
+fi
+
+MNT=$(mktemp -d)
+LIST=$(mktemp)
+trap 'fusermount3 -uq "$MNT" 2>/dev/null || true; rmdir "$MNT"; rm -f "$LIST"' EXIT
+
+now()
+{
+	date +%s.%N
+}
+
+elapsed()
+{
+	echo "$1 $2" | awk '{ printf "%.3f", $2 - $1 }'
+}
+
+run()
+{
+	name=$1
+	shift
+
+	"$GITFS" mount "$REPO" "$MNT" "$@"
+
+	# The first round also warms the gitfs caches, report it separately
+	round=0
+	while [ "$round" -le "$ROUNDS" ]; do
+		# Entries inside a commit are cached by the kernel for a year, forget
+		# them so every round reaches gitfs again. The gitfs caches stay warm.
+		sync
+		echo 2 > /proc/sys/vm/drop_caches
+
+		start=$(now)
+		find "$MNT/$COMMIT" > "$LIST"
+		found=$(now)
+		xargs -P "$JOBS" -n 64 stat -c %s < "$LIST" > /dev/null
+		done=$(now)
+
+		label=$round
+		[ "$round" -eq 0 ] && label=cold
+		printf '%-9s round=%-4s files=%-7s find=%ss stat=%ss\n' "$name" "$label" "$(wc -l < "$LIST")" \
+			"$(elapsed "$start" "$found")" "$(elapsed "$found" "$done")"
+
+		round=$((round + 1))
+	done
+
+	fusermount3 -uq "$MNT"
+}
+
+run dev_fuse
+run io_uring -o io_uring